@@ -0,0 +1,248 @@
+/*
+ * file dfrobot-esp-ph-array.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Drives several Gravity: Analog pH Sensor / Meter Kit V2 (SKU: SEN0161-V2) probes from one object
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph-array.h"
+#include <time.h>
+
+/**
+ * @brief Constructor, starts with no channels and linear 12-bit/3.3V scaling
+ * 
+ */
+DFRobotESPpHArray::DFRobotESPpHArray()
+{
+    this->_count = 0;
+    this->_mvPerCount = 3300 / 4096.0;
+    this->_adcTable = NULL;
+    this->_compTemperature = 25.0;
+    this->_dirty = 0;
+}
+
+/**
+ * @brief Sets the ADC scaling shared by all channels
+ * 
+ * @param ESPADC_in Input for ADC from ESP32
+ * @param ESPVOLTAGE_in Input for ESP32 Voltage source
+ * @param useAdcCalibration use the eFuse calibrated lookup table when the chip provides one
+ */
+void DFRobotESPpHArray::init(float ESPADC_in, float ESPVOLTAGE_in, boolean useAdcCalibration) {
+    this->_mvPerCount = ESPVOLTAGE_in / ESPADC_in;
+    this->_adcTable = useAdcCalibration ? dfrobotPHAdcMillivoltTable() : NULL;
+}
+
+/**
+ * @brief Adds a probe with the typical calibration
+ * 
+ * @param pin analog pin of the probe
+ * @return int channel index, -1 if full
+ */
+int DFRobotESPpHArray::addProbe(int pin) {
+    if (this->_count >= PH_ARRAY_MAX_PROBES)
+    {
+        return -1;
+    }
+    byte channel = this->_count++;
+    this->_pins[channel] = pin;
+    this->_neutralVoltage[channel] = PH_DEFAULT_NEUTRAL_VOLTAGE;
+    this->_acidVoltage[channel] = PH_DEFAULT_ACID_VOLTAGE;
+    this->_calTemperature[channel] = 25.0;
+    this->_raw[channel] = 0;
+    this->_voltage[channel] = PH_DEFAULT_NEUTRAL_VOLTAGE;
+    this->_phValue[channel] = 7.0;
+    updateCoefficients(channel);
+    return channel;
+}
+
+/**
+ * @brief Loads every channel's calibration from NVS
+ * 
+ */
+void DFRobotESPpHArray::begin() {
+    char key[PH_NVS_KEY_LENGTH];
+    Preferences &preferences = dfrobotPHPreferences();
+    DFRobotESPpHCalibrationBlob blob;
+    for (byte channel = 0; channel < this->_count; channel++)
+    {
+        snprintf(key, sizeof(key), PH_ARRAY_NVS_KEY, channel);
+        byte version = dfrobotPHLoadCalibration(key, &blob);
+        if (version != 0)
+        {
+            this->_neutralVoltage[channel] = blob.neutralVoltage;
+            this->_acidVoltage[channel] = blob.acidVoltage;
+            this->_calTemperature[channel] = blob.temperature;
+            if (version != PH_CALIBRATION_VERSION)
+            {
+                this->_dirty |= 1 << channel; // rewrite in the current layout
+            }
+        }
+        else
+        {
+            // no blob yet, or a corrupt one: fall back to the per-key values of older versions
+            snprintf(key, sizeof(key), "voltage7_%u", channel);
+            float neutral = preferences.getFloat(key, 0);
+            snprintf(key, sizeof(key), "voltage4_%u", channel);
+            float acid = preferences.getFloat(key, 0);
+            if (neutral != 0 && acid != 0)
+            {
+                this->_dirty |= 1 << channel; // migrate to a blob
+            }
+            this->_neutralVoltage[channel] = neutral != 0 ? neutral : PH_DEFAULT_NEUTRAL_VOLTAGE;
+            this->_acidVoltage[channel] = acid != 0 ? acid : PH_DEFAULT_ACID_VOLTAGE;
+            this->_calTemperature[channel] = 25.0;
+        }
+        updateCoefficients(channel);
+    }
+    saveCalibration(); // only the channels found in an older layout
+}
+
+/**
+ * @brief Recomputes the linear fit of one channel from its calibration voltages
+ * 
+ * @param channel channel index
+ */
+void DFRobotESPpHArray::updateCoefficients(byte channel) {
+    float slope = (7.0 - 4.0) / (this->_neutralVoltage[channel] - this->_acidVoltage[channel]);
+    float intercept = 7.0 - slope * this->_neutralVoltage[channel];
+    float factor = dfrobotPHNernstFactorFrom(this->_compTemperature, this->_calTemperature[channel]);
+    this->_slope[channel] = slope;
+    this->_intercept[channel] = intercept;
+    this->_compSlope[channel] = factor * slope;
+    this->_compIntercept[channel] = 7.0 + factor * (intercept - 7.0);
+}
+
+/**
+ * @brief Applies the Nernst correction for a temperature to every channel
+ *        relative to the temperature each channel was calibrated at
+ * 
+ * @param temperature temperature of the water
+ */
+void DFRobotESPpHArray::updateTemperatureCompensation(float temperature) {
+    this->_compTemperature = temperature;
+    for (byte channel = 0; channel < this->_count; channel++)
+    {
+        float factor = dfrobotPHNernstFactorFrom(temperature, this->_calTemperature[channel]);
+        this->_compSlope[channel] = factor * this->_slope[channel];
+        this->_compIntercept[channel] = 7.0 + factor * (this->_intercept[channel] - 7.0);
+    }
+}
+
+/**
+ * @brief Samples every channel, then converts them all
+ * 
+ * @param temperature temperature of the water
+ */
+void DFRobotESPpHArray::update(float temperature) {
+    byte count = this->_count;
+
+    // acquisition first, back to back, so the channels are sampled as close together as possible
+    for (byte channel = 0; channel < count; channel++)
+    {
+        this->_raw[channel] = analogRead(this->_pins[channel]);
+    }
+
+    float delta = temperature - this->_compTemperature;
+    if (delta > PH_TEMPERATURE_THRESHOLD || delta < -PH_TEMPERATURE_THRESHOLD)
+    {
+        updateTemperatureCompensation(temperature);
+    }
+
+    if (this->_adcTable != NULL)
+    {
+        for (byte channel = 0; channel < count; channel++)
+        {
+            this->_voltage[channel] = this->_adcTable[this->_raw[channel] < PH_ADC_LUT_SIZE ? this->_raw[channel] : PH_ADC_LUT_SIZE];
+        }
+    }
+    else
+    {
+        for (byte channel = 0; channel < count; channel++)
+        {
+            this->_voltage[channel] = this->_raw[channel] * this->_mvPerCount;
+        }
+    }
+    for (byte channel = 0; channel < count; channel++)
+    {
+        this->_phValue[channel] = this->_compSlope[channel] * this->_voltage[channel] + this->_compIntercept[channel];
+    }
+}
+
+/**
+ * @brief Sets the calibration voltages of one channel
+ * 
+ * @param channel channel index
+ * @param voltage7 voltage at pH 7
+ * @param voltage4 voltage at pH 4
+ * @param temperature temperature of the buffers
+ */
+void DFRobotESPpHArray::setCalibration(byte channel, float voltage7, float voltage4, float temperature) {
+    if (channel >= this->_count)
+    {
+        return;
+    }
+    this->_neutralVoltage[channel] = voltage7;
+    this->_acidVoltage[channel] = voltage4;
+    this->_calTemperature[channel] = temperature;
+    this->_dirty |= 1 << channel;
+    updateCoefficients(channel);
+}
+
+/**
+ * @brief Stores the blob of every changed channel in NVS
+ *        A channel whose write fails stays marked and is retried by the next call
+ * 
+ */
+void DFRobotESPpHArray::saveCalibration() {
+    char key[PH_NVS_KEY_LENGTH];
+    DFRobotESPpHCalibrationBlob blob;
+    for (byte channel = 0; channel < this->_count; channel++)
+    {
+        if (!(this->_dirty & (1 << channel)))
+        {
+            continue;
+        }
+        memset(&blob, 0, sizeof(blob));
+        blob.neutralVoltage = this->_neutralVoltage[channel];
+        blob.acidVoltage = this->_acidVoltage[channel];
+        blob.slope = this->_slope[channel];
+        blob.intercept = this->_intercept[channel];
+        blob.temperature = this->_calTemperature[channel];
+        blob.timestamp = (uint32_t)time(NULL);
+        snprintf(key, sizeof(key), PH_ARRAY_NVS_KEY, channel);
+        if (dfrobotPHStoreCalibration(key, &blob))
+        {
+            this->_dirty &= ~(1 << channel);
+        }
+    }
+}
+
+/**
+ * @brief Gets the pH of a channel
+ * 
+ * @param channel channel index
+ * @return float pH from the last update()
+ */
+float DFRobotESPpHArray::getPH(byte channel) {
+    return channel < this->_count ? this->_phValue[channel] : 0;
+}
+
+/**
+ * @brief Gets the voltage of a channel
+ * 
+ * @param channel channel index
+ * @return float voltage in mV from the last update()
+ */
+float DFRobotESPpHArray::getVoltage(byte channel) {
+    return channel < this->_count ? this->_voltage[channel] : 0;
+}
+
+/**
+ * @brief Gets the number of channels
+ * 
+ * @return byte 
+ */
+byte DFRobotESPpHArray::size() {
+    return this->_count;
+}
@@ -0,0 +1,93 @@
+/*
+ * file dfrobot-esp-ph-array.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Drives several Gravity: Analog pH Sensor / Meter Kit V2 (SKU: SEN0161-V2) probes from one object
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_ARRAY_H_
+#define _DFROBOT_ESP_PH_ARRAY_H_
+
+#include "dfrobot-esp-ph.h"
+
+#define PH_ARRAY_MAX_PROBES 8 //channels per DFRobotESPpHArray
+#define PH_ARRAY_NVS_KEY "phcal_%u" //calibration blob key of a channel, formatted with the channel index
+
+/**
+ * @brief Several pH probes with their calibrations kept side by side (struct of arrays)
+ *        update() reads every pin back to back and converts all channels in one pass,
+ *        and the calibrations of all channels go through the library's shared Preferences handle
+ */
+class DFRobotESPpHArray {
+private:
+    byte _count;
+    float _mvPerCount;         // ESPVOLTAGE / ESPADC
+    const uint16_t *_adcTable; // eFuse calibrated count to mV table, NULL for linear scaling
+    float _compTemperature;    // temperature the compensated fits were computed for
+
+    uint8_t _pins[PH_ARRAY_MAX_PROBES];
+    float _neutralVoltage[PH_ARRAY_MAX_PROBES];
+    float _acidVoltage[PH_ARRAY_MAX_PROBES];
+    float _slope[PH_ARRAY_MAX_PROBES];
+    float _intercept[PH_ARRAY_MAX_PROBES];
+    float _calTemperature[PH_ARRAY_MAX_PROBES]; // temperature each channel was calibrated at
+    float _compSlope[PH_ARRAY_MAX_PROBES];
+    float _compIntercept[PH_ARRAY_MAX_PROBES];
+    uint16_t _raw[PH_ARRAY_MAX_PROBES];
+    float _voltage[PH_ARRAY_MAX_PROBES];
+    float _phValue[PH_ARRAY_MAX_PROBES];
+    uint8_t _dirty; // one bit per channel changed since the last saveCalibration()
+
+    void updateCoefficients(byte channel);
+    void updateTemperatureCompensation(float temperature);
+
+public:
+    DFRobotESPpHArray();
+    /**
+     * @brief Sets the ADC scaling shared by all channels, see DFRobotESPpH::init()
+     * 
+     * @param ESPADC_in ADC full scale count, used for linear scaling
+     * @param ESPVOLTAGE_in ADC reference voltage in mV, used for linear scaling
+     * @param useAdcCalibration true to use the eFuse lookup table when the chip has one
+     */
+    void init(float ESPADC_in, float ESPVOLTAGE_in, boolean useAdcCalibration = false);
+    /**
+     * @brief Adds a probe on an analog pin
+     * 
+     * @param pin Analog pin of the pH board
+     * @return int channel index, -1 if PH_ARRAY_MAX_PROBES channels are already used
+     */
+    int addProbe(int pin);
+    /**
+     * @brief Loads the calibration of every channel through the shared NVS handle
+     *        Each channel has its own DFRobotESPpHCalibrationBlob under PH_ARRAY_NVS_KEY, validated like
+     *        DFRobotESPpH::begin() does. Channels still stored as voltage7_<n>/voltage4_<n> keys are moved
+     *        to a blob, channels without stored values keep the typical 1348.68/1844.17 mV.
+     */
+    void begin();
+    /**
+     * @brief Reads all probes back to back, then converts all of them to pH
+     * 
+     * @param temperature Temperature in degress celcius, shared by all probes
+     */
+    void update(float temperature);
+    /**
+     * @brief Sets the calibration of one channel, kept in RAM until saveCalibration()
+     * 
+     * @param channel Channel index from addProbe()
+     * @param voltage7 Voltage of the probe in pH 7 buffer solution
+     * @param voltage4 Voltage of the probe in pH 4 buffer solution
+     * @param temperature Temperature in degress celcius of the buffers while measuring them
+     */
+    void setCalibration(byte channel, float voltage7, float voltage4, float temperature = 25.0);
+    /**
+     * @brief Writes the blob of every channel changed since the last save, one NVS write per channel
+     */
+    void saveCalibration();
+    float getPH(byte channel);      // pH of a channel from the last update()
+    float getVoltage(byte channel); // voltage in mV of a channel from the last update()
+    byte size();                    // number of channels added
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * file dfrobot-esp-ph-history.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Fixed-capacity sample history, rolling statistics and trend detection for DFRobotESPpH
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_HISTORY_H_
+#define _DFROBOT_ESP_PH_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * @brief Ring buffer of the last N samples with O(1) mean, variance, min and max
+ *        Mean and variance are kept with a sliding Welford update. Min and max come from
+ *        monotonic queues of sample positions, so no query rescans the buffer.
+ *        All storage is static, sized by N (at most 65535).
+ */
+template <uint16_t N>
+class DFRobotESPpHHistory {
+private:
+    float _values[N];
+    uint16_t _head;   // position of the next sample in _values
+    uint16_t _count;  // samples held, up to N
+    uint16_t _total;  // samples pushed so far, wraps; sample k has position k in the queues
+    uint16_t _sinceRefresh;
+    float _mean;
+    float _m2;        // sum of squared distances from the mean
+
+    // monotonic queues of sample positions: _minQueue values increase, _maxQueue values decrease
+    uint16_t _minQueue[N];
+    uint16_t _maxQueue[N];
+    uint16_t _minFront, _minSize;
+    uint16_t _maxFront, _maxSize;
+
+    float valueAt(uint16_t position) const {
+        // the value of sample position p sits (_total - p) slots behind _head
+        uint16_t back = (uint16_t)(_total - position);
+        return _values[(_head + N - back) % N];
+    }
+
+    void pushQueue(uint16_t *queue, uint16_t &front, uint16_t &size, float value, bool keepSmaller) {
+        // drop the entry that just left the window, then every entry the new value dominates
+        if (size > 0 && (uint16_t)(_total - queue[front]) > N)
+        {
+            front = (front + 1) % N;
+            size--;
+        }
+        while (size > 0)
+        {
+            float last = valueAt(queue[(front + size - 1) % N]);
+            if (keepSmaller ? last < value : last > value)
+            {
+                break;
+            }
+            size--;
+        }
+        queue[(front + size) % N] = (uint16_t)(_total - 1);
+        size++;
+    }
+
+    void refresh() {
+        // exact recomputation every N samples keeps the float rounding of the sliding update bounded
+        float sum = 0;
+        for (uint16_t i = 0; i < _count; i++)
+        {
+            sum += _values[i];
+        }
+        _mean = sum / _count;
+        float m2 = 0;
+        for (uint16_t i = 0; i < _count; i++)
+        {
+            float delta = _values[i] - _mean;
+            m2 += delta * delta;
+        }
+        _m2 = m2;
+        _sinceRefresh = 0;
+    }
+
+public:
+    DFRobotESPpHHistory() {
+        clear();
+    }
+
+    /**
+     * @brief Drops every sample
+     */
+    void clear() {
+        _head = 0;
+        _count = 0;
+        _total = 0;
+        _sinceRefresh = 0;
+        _mean = 0;
+        _m2 = 0;
+        _minFront = _minSize = 0;
+        _maxFront = _maxSize = 0;
+    }
+
+    /**
+     * @brief Adds a sample, replacing the oldest one once N samples are held
+     * 
+     * @param value Sample
+     */
+    void push(float value) {
+        if (_count < N)
+        {
+            _count++;
+            float delta = value - _mean;
+            _mean += delta / _count;
+            _m2 += delta * (value - _mean);
+        }
+        else
+        {
+            float old = _values[_head];
+            float mean = _mean + (value - old) * (1.0f / N);
+            _m2 += (value - old) * (value - mean + old - _mean);
+            _mean = mean;
+        }
+        _values[_head] = value;
+        _head = (_head + 1) % N;
+        _total++;
+        pushQueue(_minQueue, _minFront, _minSize, value, true);
+        pushQueue(_maxQueue, _maxFront, _maxSize, value, false);
+        if (++_sinceRefresh >= N)
+        {
+            refresh();
+        }
+    }
+
+    uint16_t size() const { return _count; }        // samples held
+    uint16_t capacity() const { return N; }         // samples held once full
+    float mean() const { return _mean; }            // mean of the held samples
+    float min() const { return _minSize ? valueAt(_minQueue[_minFront]) : 0; } // smallest held sample
+    float max() const { return _maxSize ? valueAt(_maxQueue[_maxFront]) : 0; } // largest held sample
+    float newest() const { return _count ? _values[(_head + N - 1) % N] : 0; } // last pushed sample
+    float oldest() const { return _count ? _values[(_head + N - _count) % N] : 0; } // first held sample
+
+    /**
+     * @brief Gets the population variance of the held samples
+     * 
+     * @return float 
+     */
+    float variance() const {
+        return _count > 0 && _m2 > 0 ? _m2 / _count : 0;
+    }
+
+    /**
+     * @brief Gets the population standard deviation of the held samples
+     * 
+     * @return float 
+     */
+    float stddev() const {
+        return sqrtf(variance());
+    }
+};
+
+/**
+ * @brief Least-squares slope of the last N samples against the time they were taken, updated in O(1)
+ *        Sums of x, x*x, y and x*y slide with the window, x being seconds since a base time that is
+ *        moved to the oldest sample every N pushes to keep the float sums small. Samples do not have
+ *        to be evenly spaced, so a change of the sampling period does not bend the slope.
+ *        Used to tell when a reading has settled.
+ */
+template <uint16_t N>
+class DFRobotESPpHTrend {
+private:
+    float _values[N];
+    uint32_t _times[N]; // millis() of each sample
+    uint16_t _head;  // position of the next sample in _values, the oldest sample once full
+    uint16_t _count;
+    uint16_t _sinceRefresh;
+    uint32_t _base;  // millis() at x = 0
+    float _sumX;
+    float _sumXX;
+    float _sumY;
+    float _sumXY;
+
+    float offset(uint32_t time) const {
+        return (int32_t)(time - _base) * 0.001f; // wraps with millis()
+    }
+
+    void refresh() {
+        _base = _times[_head];
+        float sumX = 0, sumXX = 0, sumY = 0, sumXY = 0;
+        for (uint16_t i = 0; i < N; i++)
+        {
+            float x = offset(_times[i]);
+            float y = _values[i];
+            sumX += x;
+            sumXX += x * x;
+            sumY += y;
+            sumXY += x * y;
+        }
+        _sumX = sumX;
+        _sumXX = sumXX;
+        _sumY = sumY;
+        _sumXY = sumXY;
+        _sinceRefresh = 0;
+    }
+
+public:
+    DFRobotESPpHTrend() {
+        clear();
+    }
+
+    /**
+     * @brief Drops every sample
+     */
+    void clear() {
+        _head = 0;
+        _count = 0;
+        _sinceRefresh = 0;
+        _base = 0;
+        _sumX = 0;
+        _sumXX = 0;
+        _sumY = 0;
+        _sumXY = 0;
+    }
+
+    /**
+     * @brief Adds a sample, replacing the oldest one once N samples are held
+     * 
+     * @param value Sample
+     * @param time millis() the sample was taken
+     */
+    void push(float value, uint32_t time) {
+        if (_count == 0)
+        {
+            _base = time;
+        }
+        float x = offset(time);
+        if (_count < N)
+        {
+            _count++;
+        }
+        else
+        {
+            float oldX = offset(_times[_head]);
+            float oldY = _values[_head];
+            _sumX -= oldX;
+            _sumXX -= oldX * oldX;
+            _sumY -= oldY;
+            _sumXY -= oldX * oldY;
+        }
+        _sumX += x;
+        _sumXX += x * x;
+        _sumY += value;
+        _sumXY += x * value;
+        _values[_head] = value;
+        _times[_head] = time;
+        _head = (_head + 1) % N;
+        if (_count == N && ++_sinceRefresh >= N)
+        {
+            refresh();
+        }
+    }
+
+    bool full() const { return _count == N; }           // N samples held, slope() is meaningful
+    float mean() const { return _count ? _sumY / _count : 0; } // mean of the held samples
+
+    /**
+     * @brief Gets the least-squares slope over the window
+     * 
+     * @return float change per second, 0 until the window is full or if all samples share one time
+     */
+    float slope() const {
+        if (_count < N || N < 2)
+        {
+            return 0;
+        }
+        float denominator = N * _sumXX - _sumX * _sumX;
+        if (denominator <= 0)
+        {
+            return 0;
+        }
+        return (N * _sumXY - _sumX * _sumY) / denominator;
+    }
+};
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * file dfrobot-esp-ph-kernel.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Platform independent pH conversion kernels used by DFRobotESPpH
+ * 
+ * This header only depends on the C standard library so the exact same conversion code
+ * can be built for the ESP32 and for x86/ARM hosts that post-process logged voltages.
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_KERNEL_H_
+#define _DFROBOT_ESP_PH_KERNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Converts one voltage to pH with a precomputed linear fit
+ * 
+ * @param slope pH per mV
+ * @param intercept pH at 0 mV
+ * @param voltage Voltage of the pH board in mV
+ * @return float pH value
+ */
+static inline float dfrobotPHFromVoltage(float slope, float intercept, float voltage) {
+    return slope * voltage + intercept;
+}
+
+/**
+ * @brief Converts an array of voltages to pH with a precomputed linear fit
+ *        Single branch-free loop over non-aliasing arrays so the compiler can vectorize it
+ * 
+ * @param slope pH per mV
+ * @param intercept pH at 0 mV
+ * @param voltage Voltages of the pH board in mV
+ * @param out Receives the pH values, must not overlap voltage
+ * @param n Number of samples
+ */
+static inline void dfrobotPHFromVoltageBatch(float slope, float intercept,
+                                             const float *__restrict voltage, float *__restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = slope * voltage[i] + intercept;
+    }
+}
+
+/**
+ * @brief Converts an ADC count to millivolts through a lookup table
+ *        Fractional counts from averaging are interpolated between the two neighbouring entries
+ * 
+ * @param table size + 1 millivolt entries, one per count plus a copy of the last one
+ * @param size Number of ADC counts covered by the table
+ * @param raw ADC count
+ * @return float voltage in mV
+ */
+static inline float dfrobotPHMillivoltsFromTable(const uint16_t *table, uint32_t size, float raw) {
+    uint32_t index = (uint32_t)raw;
+    if (index >= size)
+    {
+        return table[size];
+    }
+    float low = table[index];
+    return low + (raw - index) * (table[index + 1] - low);
+}
+
+#define PH_MAX_CAL_POINTS 5                   //buffer solutions a calibration can hold, pH 4.0 and 7.0 included
+#define PH_MAX_SEGMENTS (PH_MAX_CAL_POINTS - 1) //linear pieces between neighbouring buffers
+
+/**
+ * @brief Piecewise linear voltage to pH conversion, one segment per pair of neighbouring buffers
+ *        Voltages outside the calibrated range are extrapolated with the first/last segment
+ */
+typedef struct {
+    uint8_t count;                    // segments in use, 1 for a plain two-point calibration
+    float bound[PH_MAX_SEGMENTS - 1]; // mV where segment i + 1 takes over from segment i, ascending
+    float slope[PH_MAX_SEGMENTS];     // pH per mV of each segment
+    float intercept[PH_MAX_SEGMENTS]; // pH at 0 mV of each segment
+} DFRobotESPpHSegments;
+
+/**
+ * @brief Builds the segments through a set of calibration points
+ *        Meant to run at calibration time. Points are sorted by voltage, points with the same
+ *        voltage as a previous one are ignored.
+ * 
+ * @param segments Receives the segments
+ * @param voltage Buffer voltages in mV
+ * @param ph Buffer pH values
+ * @param n Number of points, at most PH_MAX_CAL_POINTS
+ * @return uint8_t number of segments built, 0 if fewer than two distinct points were given
+ */
+static inline uint8_t dfrobotPHSegmentsBuild(DFRobotESPpHSegments *segments, const float *voltage, const float *ph, uint8_t n) {
+    float v[PH_MAX_CAL_POINTS], p[PH_MAX_CAL_POINTS];
+    uint8_t points = 0;
+    for (uint8_t i = 0; i < n && i < PH_MAX_CAL_POINTS; i++)
+    {
+        // insertion into the sorted copy, duplicates dropped
+        uint8_t j = points;
+        while (j > 0 && v[j - 1] > voltage[i])
+        {
+            j--;
+        }
+        if (j > 0 && v[j - 1] == voltage[i])
+        {
+            continue;
+        }
+        for (uint8_t k = points; k > j; k--)
+        {
+            v[k] = v[k - 1];
+            p[k] = p[k - 1];
+        }
+        v[j] = voltage[i];
+        p[j] = ph[i];
+        points++;
+    }
+    segments->count = points >= 2 ? points - 1 : 0;
+    for (uint8_t i = 0; i + 1 < points; i++)
+    {
+        segments->slope[i] = (p[i + 1] - p[i]) / (v[i + 1] - v[i]);
+        segments->intercept[i] = p[i] - segments->slope[i] * v[i];
+        if (i > 0)
+        {
+            segments->bound[i - 1] = v[i];
+        }
+    }
+    return segments->count;
+}
+
+/**
+ * @brief Converts one voltage to pH through precomputed segments
+ *        The segment index is a sum of comparisons, so there is no data dependent branch
+ * 
+ * @param segments Segments from dfrobotPHSegmentsBuild()
+ * @param voltage Voltage of the pH board in mV
+ * @return float pH value
+ */
+static inline float dfrobotPHFromSegments(const DFRobotESPpHSegments *segments, float voltage) {
+    uint8_t index = 0;
+    for (uint8_t i = 0; i + 1 < segments->count; i++)
+    {
+        index += voltage > segments->bound[i];
+    }
+    return segments->slope[index] * voltage + segments->intercept[index];
+}
+
+/**
+ * @brief Converts an array of voltages to pH through precomputed segments
+ * 
+ * @param segments Segments from dfrobotPHSegmentsBuild()
+ * @param voltage Voltages of the pH board in mV
+ * @param out Receives the pH values, must not overlap voltage
+ * @param n Number of samples
+ */
+static inline void dfrobotPHFromSegmentsBatch(const DFRobotESPpHSegments *segments,
+                                              const float *__restrict voltage, float *__restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = dfrobotPHFromSegments(segments, voltage[i]);
+    }
+}
+
+#define PH_NERNST_REFERENCE_KELVIN 298.15 //calibration buffers are specified at 25C
+#define PH_NERNST_TABLE_SIZE 102          //compensation factors for 0C..101C in 1C steps
+
+/**
+ * @brief Nernstian slope correction for a temperature, (25C in K) / (T in K)
+ *        The electrode slope grows with absolute temperature, so the pH distance from the
+ *        isopotential point (taken as pH 7) shrinks by this factor
+ * 
+ * @param temperature Temperature in degress celcius
+ * @return float factor applied to (pH - 7)
+ */
+static inline float dfrobotPHNernstFactor(float temperature) {
+    return (float)(PH_NERNST_REFERENCE_KELVIN / (temperature + 273.15));
+}
+
+/**
+ * @brief Nernstian slope correction from the calibration temperature, (Tcal in K) / (T in K)
+ *        A fit through buffers measured at Tcal already has the slope of Tcal, so only the
+ *        difference to the measuring temperature is corrected; 1 when both are equal
+ * 
+ * @param temperature Temperature in degress celcius
+ * @param calTemperature Temperature in degress celcius the calibration was taken at
+ * @return float factor applied to (pH - 7)
+ */
+static inline float dfrobotPHNernstFactorFrom(float temperature, float calTemperature) {
+    return (float)((calTemperature + 273.15) / (temperature + 273.15));
+}
+
+/**
+ * @brief Fills a table of Nernst factors, PH_NERNST_TABLE_SIZE entries for 0C, 1C, 2C...
+ * 
+ * @param table Receives the factors
+ */
+static inline void dfrobotPHNernstTableInit(float *table) {
+    for (int i = 0; i < PH_NERNST_TABLE_SIZE; i++)
+    {
+        table[i] = dfrobotPHNernstFactor((float)i);
+    }
+}
+
+/**
+ * @brief Converts an array of voltages to temperature compensated pH values
+ *        The Nernst factor is interpolated from a table built with dfrobotPHNernstTableInit(),
+ *        so there is no division per sample. Temperatures are clamped to the table range.
+ * 
+ * @param slope pH per mV at 25C
+ * @param intercept pH at 0 mV at 25C
+ * @param table Nernst factor table
+ * @param voltage Voltages of the pH board in mV
+ * @param temperature Temperatures in degress celcius, one per voltage
+ * @param out Receives the pH values, must not overlap the inputs
+ * @param n Number of samples
+ */
+static inline void dfrobotPHFromVoltageBatchCompensated(float slope, float intercept, const float *__restrict table,
+                                                        const float *__restrict voltage, const float *__restrict temperature,
+                                                        float *__restrict out, size_t n) {
+    const float top = (float)(PH_NERNST_TABLE_SIZE - 1) - 0.001f; // keeps index + 1 inside the table
+    for (size_t i = 0; i < n; i++)
+    {
+        float t = temperature[i];
+        t = t < 0.0f ? 0.0f : t;
+        t = t > top ? top : t;
+        int index = (int)t;
+        float factor = table[index] + (t - index) * (table[index + 1] - table[index]);
+        out[i] = 7.0f + factor * (slope * voltage[i] + intercept - 7.0f);
+    }
+}
+
+#define PH_CALIBRATION_VERSION 3 //layout version of DFRobotESPpHCalibrationBlob
+#define PH_CALIBRATION_V1_SIZE 32 //version 1 ended after timestamp with 2 reserved bytes and the crc
+#define PH_CALIBRATION_V2_SIZE 60 //version 2 ended after extraPH with 2 reserved bytes and the crc
+
+/**
+ * @brief Calibration record stored as a single NVS blob per probe
+ *        Little-endian, natural alignment, 72 bytes in version 3. Hosts can decode it with this header.
+ *        Older records are this layout cut after timestamp (version 1) or extraPH (version 2),
+ *        followed by 2 reserved bytes and the crc.
+ */
+typedef struct {
+    uint16_t version;     // PH_CALIBRATION_VERSION
+    uint16_t size;        // sizeof(DFRobotESPpHCalibrationBlob), catches layout changes
+    float neutralVoltage; // mV in pH 7.0 buffer
+    float acidVoltage;    // mV in pH 4.0 buffer
+    float slope;          // pH per mV at temperature, pH 4.0/7.0 fit
+    float intercept;      // pH at 0 mV at temperature, pH 4.0/7.0 fit
+    float temperature;    // temperature in C seen while calibrating
+    uint32_t timestamp;   // seconds since 1970 when calibrated, small values mean the clock was not set
+    uint8_t extraCount;   // buffers beyond pH 4.0 and 7.0 in use
+    uint8_t reserved[3];
+    float extraVoltage[PH_MAX_CAL_POINTS - 2]; // mV of the additional buffers
+    float extraPH[PH_MAX_CAL_POINTS - 2];      // pH of the additional buffers
+    float nernstPercent;  // probe slope over the pH 4.0/7.0 span in % of the Nernstian slope at temperature, 0 from DFRobotESPpHArray
+    float offset;         // probe mV in the pH 7.0 buffer, ideally 0, 0 from DFRobotESPpHArray
+    uint32_t responseMs;  // settling time of the slowest buffer, 0 if it was not measured
+    uint16_t reserved2;
+    uint16_t crc;         // dfrobotPHCrc16() over all bytes before this field
+} DFRobotESPpHCalibrationBlob;
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) used to validate stored records
+ * 
+ * @param data Bytes to check
+ * @param length Number of bytes
+ * @return uint16_t 
+ */
+static inline uint16_t dfrobotPHCrc16(const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)bytes[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Applies a Nernst factor to segments, pH = 7 + factor * (uncompensated pH - 7) folded into each segment
+ * 
+ * @param out Receives the compensated segments, may be segments itself
+ * @param segments Segments as calibrated
+ * @param factor Factor from dfrobotPHNernstFactorFrom()
+ */
+static inline void dfrobotPHSegmentsCompensate(DFRobotESPpHSegments *out, const DFRobotESPpHSegments *segments, float factor) {
+    out->count = segments->count;
+    for (uint8_t i = 0; i < segments->count; i++)
+    {
+        out->slope[i] = factor * segments->slope[i];
+        out->intercept[i] = 7.0f + factor * (segments->intercept[i] - 7.0f);
+        if (i > 0)
+        {
+            out->bound[i - 1] = segments->bound[i - 1];
+        }
+    }
+}
+
+/**
+ * @brief Applies per-sample temperature compensation to pH values computed at 25C, in place
+ * 
+ * @param table Nernst factor table from dfrobotPHNernstTableInit()
+ * @param temperature Temperatures in degress celcius, one per value
+ * @param ph pH values at 25C, replaced by the compensated values
+ * @param n Number of samples
+ */
+static inline void dfrobotPHNernstApplyBatch(const float *__restrict table, const float *__restrict temperature,
+                                             float *__restrict ph, size_t n) {
+    const float top = (float)(PH_NERNST_TABLE_SIZE - 1) - 0.001f;
+    for (size_t i = 0; i < n; i++)
+    {
+        float t = temperature[i];
+        t = t < 0.0f ? 0.0f : t;
+        t = t > top ? top : t;
+        int index = (int)t;
+        float factor = table[index] + (t - index) * (table[index + 1] - table[index]);
+        ph[i] = 7.0f + factor * (ph[i] - 7.0f);
+    }
+}
+
+#define PH_FIXED_FRACTION_BITS 16 //fixed-point pH values are Q16.16
+#define PH_FIXED_SLOPE_BITS 24    //the per-count slope is Q8.24, it is far below 1 pH per count
+
+/**
+ * @brief Integer conversion constants, pH = slope * raw + intercept
+ */
+typedef struct {
+    int32_t slope;     // pH per ADC count, Q8.24
+    int32_t intercept; // pH at ADC count 0, Q16.16
+} DFRobotESPpHFixed;
+
+/**
+ * @brief Builds the integer conversion constants from a floating point fit over ADC counts
+ *        Meant to run once after calibration, not in the sampling path
+ * 
+ * @param slopePerCount pH per ADC count
+ * @param interceptPH pH at ADC count 0
+ * @return DFRobotESPpHFixed
+ */
+static inline DFRobotESPpHFixed dfrobotPHFixedFromFloat(float slopePerCount, float interceptPH) {
+    DFRobotESPpHFixed fixed;
+    float slope = slopePerCount * (float)(1L << PH_FIXED_SLOPE_BITS);
+    float intercept = interceptPH * (float)(1L << PH_FIXED_FRACTION_BITS);
+    fixed.slope = (int32_t)(slope + (slope >= 0 ? 0.5f : -0.5f));
+    fixed.intercept = (int32_t)(intercept + (intercept >= 0 ? 0.5f : -0.5f));
+    return fixed;
+}
+
+/**
+ * @brief Converts a raw ADC count straight to pH using only integer arithmetic
+ *        Safe for ISRs and code paths where the FPU must not be touched
+ * 
+ * @param fixed Constants from dfrobotPHFixedFromFloat()
+ * @param raw ADC count
+ * @return int32_t pH value, Q16.16
+ */
+static inline int32_t dfrobotPHFixedFromRaw(const DFRobotESPpHFixed *fixed, uint32_t raw) {
+    return (int32_t)(((int64_t)fixed->slope * raw) >> (PH_FIXED_SLOPE_BITS - PH_FIXED_FRACTION_BITS)) + fixed->intercept;
+}
+
+/**
+ * @brief Finds the ADC counts at which the pH has moved by a given amount from a reference count
+ *        Used to program a comparator (e.g. the ULP coprocessor) that only compares raw counts.
+ *        Works for either sign of the slope; the bounds are clamped to 0 and rawMax + 1.
+ * 
+ * @param fixed Constants from dfrobotPHFixedFromFloat()
+ * @param raw Reference ADC count
+ * @param band pH change to detect, Q16.16
+ * @param rawMax Highest ADC count
+ * @param low Receives the count below which the pH has moved by more than band
+ * @param high Receives the count from which on the pH has moved by more than band
+ */
+static inline void dfrobotPHFixedRawBand(const DFRobotESPpHFixed *fixed, uint32_t raw, int32_t band, uint32_t rawMax,
+                                         uint16_t *low, uint16_t *high) {
+    int64_t slope = fixed->slope < 0 ? -(int64_t)fixed->slope : fixed->slope;
+    int64_t delta = slope == 0 ? (int64_t)rawMax + 1
+                               : ((int64_t)band << (PH_FIXED_SLOPE_BITS - PH_FIXED_FRACTION_BITS)) / slope;
+    if (delta < 1)
+    {
+        delta = 1; // always leave room for the reference count itself
+    }
+    *low = (int64_t)raw > delta ? (uint16_t)(raw - delta) : 0;
+    *high = (int64_t)raw + delta <= (int64_t)rawMax ? (uint16_t)(raw + delta) : (uint16_t)(rawMax + 1);
+}
+
+/**
+ * @brief Converts a Q16.16 pH value to float, for display outside the integer path
+ * 
+ * @param ph pH value, Q16.16
+ * @return float
+ */
+static inline float dfrobotPHFixedToFloat(int32_t ph) {
+    return ph / (float)(1L << PH_FIXED_FRACTION_BITS);
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * file dfrobot-esp-ph-logger.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Binary sample log of DFRobotESPpH readings, written in page sized batches
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph-logger.h"
+
+static_assert(sizeof(DFRobotESPpHLogRecord) == 16, "the log format is 16 bytes per record");
+
+/**
+ * @brief Constructor, logs nowhere until begin()
+ * 
+ */
+DFRobotESPpHLogger::DFRobotESPpHLogger() {
+    this->_sink = NULL;
+    this->_count = 0;
+    this->_dropped = 0;
+    this->_failed = false;
+}
+
+/**
+ * @brief Destructor, writes what is left
+ * 
+ */
+DFRobotESPpHLogger::~DFRobotESPpHLogger() {
+    end();
+}
+
+/**
+ * @brief Logs to a Print
+ * 
+ * @param sink destination
+ */
+void DFRobotESPpHLogger::begin(Print &sink) {
+    end();
+    this->_sink = &sink;
+    this->_dropped = 0;
+    this->_failed = false;
+}
+
+#ifdef DFROBOT_ESP_PH_HAS_FS
+/**
+ * @brief Logs to a file opened for append
+ * 
+ * @param fs file system
+ * @param path file name
+ * @return boolean false if the file could not be opened
+ */
+boolean DFRobotESPpHLogger::begin(fs::FS &fs, const char *path) {
+    end();
+    this->_file = fs.open(path, FILE_APPEND);
+    if (!this->_file)
+    {
+        return false;
+    }
+    this->_sink = &this->_file;
+    this->_dropped = 0;
+    this->_failed = false;
+    return true;
+}
+#endif
+
+/**
+ * @brief Flushes and detaches from the sink
+ * 
+ */
+void DFRobotESPpHLogger::end() {
+    if (this->_sink == NULL)
+    {
+        return;
+    }
+    flush();
+    this->_sink = NULL;
+#ifdef DFROBOT_ESP_PH_HAS_FS
+    if (this->_file)
+    {
+        this->_file.close();
+    }
+#endif
+}
+
+/**
+ * @brief Packs one reading into the page
+ * 
+ * @param reading sample to log
+ */
+void DFRobotESPpHLogger::log(const DFRobotESPpHReading &reading) {
+    if (this->_sink == NULL)
+    {
+        return;
+    }
+    if (this->_failed)
+    {
+        this->_dropped++;
+        return;
+    }
+    DFRobotESPpHLogRecord *record = &this->_page[this->_count];
+    float temperature = reading.temperature * 100.0f;
+    if (temperature > 32767)
+    {
+        temperature = 32767;
+    }
+    else if (temperature < -32768)
+    {
+        temperature = -32768;
+    }
+    record->timestamp = reading.timestamp;
+    record->raw = reading.raw > 0 ? (uint16_t)(reading.raw + 0.5f) : 0;
+    record->temperature = (int16_t)(temperature + (temperature >= 0 ? 0.5f : -0.5f));
+    record->voltage = reading.voltage;
+    record->ph = reading.ph;
+    this->_count++;
+    if (this->_count == PH_LOG_RECORDS)
+    {
+        flush();
+    }
+}
+
+/**
+ * @brief Writes the buffered records in one call
+ * 
+ * @return boolean false if the write was short
+ */
+boolean DFRobotESPpHLogger::flush() {
+    if (this->_sink == NULL || this->_count == 0)
+    {
+        return !this->_failed;
+    }
+    size_t bytes = this->_count * sizeof(DFRobotESPpHLogRecord);
+    size_t written = this->_sink->write((const uint8_t *)this->_page, bytes);
+    this->_sink->flush();
+    if (written != bytes)
+    {
+        // a partial record may be on the medium, readers skip it by the file size as long as it stays last
+        this->_dropped += this->_count - written / sizeof(DFRobotESPpHLogRecord);
+        this->_failed = true;
+    }
+    this->_count = 0;
+    return written == bytes;
+}
+
+/**
+ * @brief Gets the buffered record count
+ * 
+ * @return uint16_t 
+ */
+uint16_t DFRobotESPpHLogger::pending() {
+    return this->_count;
+}
+
+/**
+ * @brief Gets the count of records lost to failed writes
+ * 
+ * @return uint32_t 
+ */
+uint32_t DFRobotESPpHLogger::dropped() {
+    return this->_dropped;
+}
+
+/**
+ * @brief Tells whether a short write stopped the log
+ * 
+ * @return boolean 
+ */
+boolean DFRobotESPpHLogger::failed() {
+    return this->_failed;
+}
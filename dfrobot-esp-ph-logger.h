@@ -0,0 +1,126 @@
+/*
+ * file dfrobot-esp-ph-logger.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Binary sample log of DFRobotESPpH readings, written in page sized batches
+ *
+ * Format: the file is a plain array of DFRobotESPpHLogRecord, 16 bytes each, little endian (ESP32 byte
+ * order), no header and no padding, so it can be memory-mapped and indexed as record[n]:
+ *
+ *   offset  size  type     field
+ *        0     4  uint32   timestamp    millis() of the sample
+ *        4     2  uint16   raw          ADC count, rounded
+ *        6     2  int16    temperature  C * 100, rounded
+ *        8     4  float32  voltage      mV
+ *       12     4  float32  ph
+ *
+ * A truncated last record (power loss or a short write) is a file size that is not a multiple of 16,
+ * readers should ignore the remainder. After a short write the logger stops writing, so a partial
+ * record can only ever be at the end of the file.
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_LOGGER_H_
+#define _DFROBOT_ESP_PH_LOGGER_H_
+
+#include "dfrobot-esp-ph.h"
+
+#if defined(__has_include)
+#if __has_include(<FS.h>)
+#include <FS.h>
+#define DFROBOT_ESP_PH_HAS_FS // LittleFS, SPIFFS, SD and FFat all implement fs::FS
+#endif
+#endif
+
+#ifndef PH_LOG_PAGE_SIZE
+#define PH_LOG_PAGE_SIZE 4096 //bytes buffered before a write, one flash sector / LittleFS block
+#endif
+
+/**
+ * @brief One logged sample, see the format at the top of this file
+ */
+typedef struct {
+    uint32_t timestamp;
+    uint16_t raw;
+    int16_t temperature; // C * 100
+    float voltage;
+    float ph;
+} DFRobotESPpHLogRecord;
+
+#define PH_LOG_RECORDS (PH_LOG_PAGE_SIZE / sizeof(DFRobotESPpHLogRecord)) //records per batch
+
+/**
+ * @brief Collects readings into fixed-size binary records and writes them a page at a time
+ *        The page buffer is part of the object (PH_LOG_PAGE_SIZE bytes), no heap is used.
+ *        Not thread safe: log from the task that calls getPH() (setLogger() does), or lock around it.
+ */
+class DFRobotESPpHLogger {
+private:
+    Print *_sink;
+#ifdef DFROBOT_ESP_PH_HAS_FS
+    fs::File _file; // owned when opened by begin(fs, path)
+#endif
+    uint16_t _count;        // records in _page
+    uint32_t _dropped;      // records lost to failed writes
+    boolean _failed;        // a write was short, nothing more is written until begin()
+    DFRobotESPpHLogRecord _page[PH_LOG_RECORDS];
+
+public:
+    DFRobotESPpHLogger();
+    ~DFRobotESPpHLogger();
+    /**
+     * @brief Writes batches to any Print, e.g. an fs::File or SD File opened for append by the application
+     * 
+     * @param sink Destination, must outlive the logger or the next begin()
+     */
+    void begin(Print &sink);
+#ifdef DFROBOT_ESP_PH_HAS_FS
+    /**
+     * @brief Opens path for append on a file system and writes batches to it
+     * 
+     * @param fs LittleFS, SD, FFat...
+     * @param path File name, created if missing
+     * @return boolean false if the file could not be opened
+     */
+    boolean begin(fs::FS &fs, const char *path);
+#endif
+    /**
+     * @brief Writes what is buffered and detaches from the sink, closing a file opened by begin(fs, path)
+     */
+    void end();
+    /**
+     * @brief Appends one reading, writes the page when it is full
+     * 
+     * @param reading Sample, e.g. from DFRobotESPpH::latest()
+     */
+    void log(const DFRobotESPpHReading &reading);
+    /**
+     * @brief Writes the buffered records now, e.g. before deep sleep
+     * 
+     * @return boolean false if the sink did not take all bytes; the records are then dropped
+     *         and the logger stops, see failed()
+     */
+    boolean flush();
+    /**
+     * @brief Gets the number of records waiting in RAM
+     * 
+     * @return uint16_t 
+     */
+    uint16_t pending();
+    /**
+     * @brief Gets the number of records lost to failed writes since begin()
+     * 
+     * @return uint32_t 
+     */
+    uint32_t dropped();
+    /**
+     * @brief Tells whether logging stopped after a short write
+     *        Later records would no longer start at a multiple of 16 bytes, so they are counted in
+     *        dropped() instead of written. Call begin() again, e.g. on a new file, to resume.
+     * 
+     * @return boolean 
+     */
+    boolean failed();
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * file dfrobot-esp-ph-probe.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Typed configuration presets for DFRobotESPpH
+ * A profile is a struct of constexpr constants naming one board and probe combination. DFRobotESPpHProfiled<Profile>
+ * hands its ADC scaling and buffer windows to init() and setBufferWindows(), so a board is selected by type
+ * instead of by repeating the numbers at every init() call.
+ * This is not a compile-time specialization of the sampling path: getPH() is the DFRobotESPpH code and scales
+ * and recognizes buffers through the runtime fields those calls set (_mvPerCount, _adcTable, and _windows
+ * pointing at the profile's static table), so a profiled instance is the same size and speed as a plain one.
+ * Only millivolts() and readPHRaw() use the constants directly.
+ * Settings that size buffers or are shared by all instances stay macros: ReceivedBufferLength,
+ * PH_DEFAULT_NEUTRAL_VOLTAGE/PH_DEFAULT_ACID_VOLTAGE and PH_BOARD_MIDPOINT_VOLTAGE/PH_BOARD_GAIN.
+ *
+ *   struct MyBoard : DFRobotESPpHSEN0161V2 {
+ *       static constexpr float REFERENCE_MV = 3100; // ADC reference measured on this board
+ *   };
+ *   DFRobotESPpHProfiled<MyBoard> ph;
+ *   ph.init(PH_PIN);
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#ifndef _DFROBOT_ESP_PH_PROBE_H_
+#define _DFROBOT_ESP_PH_PROBE_H_
+
+#include "dfrobot-esp-ph.h"
+
+/**
+ * @brief Gravity pH V2 (SEN0161-V2) on the ESP32 12-bit ADC, the library defaults
+ */
+struct DFRobotESPpHSEN0161V2 {
+    static constexpr float ADC_COUNTS = 4096;  // full scale count
+    static constexpr float REFERENCE_MV = 3300; // full scale voltage
+    static constexpr bool USE_ADC_CALIBRATION = false; // true for the eFuse lookup table, needs a new calibration
+    // CALPH recognition windows, mV
+    static constexpr float NEUTRAL_LOW_MV = PH_8_VOLTAGE;
+    static constexpr float NEUTRAL_HIGH_MV = PH_6_VOLTAGE;
+    static constexpr float ACID_LOW_MV = PH_5_VOLTAGE;
+    static constexpr float ACID_HIGH_MV = PH_3_VOLTAGE;
+    static constexpr float BASE_LOW_MV = PH_11_VOLTAGE;
+    static constexpr float BASE_HIGH_MV = PH_9_VOLTAGE;
+};
+
+/**
+ * @brief DFRobotESPpH configured from a board and probe profile
+ *
+ * @tparam Profile struct with the constants of DFRobotESPpHSEN0161V2
+ */
+template <class Profile>
+class DFRobotESPpHProfiled : public DFRobotESPpH {
+public:
+    static constexpr float MV_PER_COUNT = Profile::REFERENCE_MV / Profile::ADC_COUNTS;
+
+    /**
+     * @brief Assigns the pH pin, the scaling and buffer windows come from Profile
+     *
+     * @param PH_PIN_in Analog pin of the pH board
+     */
+    void init(int PH_PIN_in) {
+        static const DFRobotESPpHBufferWindow windows[] = {
+            {7.0, Profile::NEUTRAL_LOW_MV, Profile::NEUTRAL_HIGH_MV},
+            {4.0, Profile::ACID_LOW_MV, Profile::ACID_HIGH_MV},
+            {10.0, Profile::BASE_LOW_MV, Profile::BASE_HIGH_MV},
+        };
+        DFRobotESPpH::init(PH_PIN_in, Profile::ADC_COUNTS, Profile::REFERENCE_MV, Profile::USE_ADC_CALIBRATION);
+        setBufferWindows(windows, sizeof(windows) / sizeof(windows[0]));
+    }
+
+    /**
+     * @brief Converts a raw ADC count to millivolts with the profile's linear scaling, a constant expression
+     *
+     * @param raw ADC count
+     * @return float mV
+     */
+    static constexpr float millivolts(float raw) {
+        return raw * MV_PER_COUNT;
+    }
+
+    /**
+     * @brief Converts a raw ADC count to pH, for counts sampled outside getPH()
+     *        Uses the profile's linear scaling, not the eFuse lookup table
+     *
+     * @param raw ADC count
+     * @param temperature Temperature in degress celcius
+     * @return float
+     */
+    float readPHRaw(float raw, float temperature) {
+        return readPH(millivolts(raw), temperature);
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * file dfrobot-esp-ph-profile.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Stage counters behind dfrobot-esp-ph-profile.h, empty unless DFROBOT_ESP_PH_PROFILE is defined
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph.h"
+
+#ifdef DFROBOT_ESP_PH_PROFILE
+
+static struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profileStages[PH_PROFILE_STAGES];
+
+static const char *const profileNames[PH_PROFILE_STAGES] = {"adc", "filter", "scale", "convert", "nvs load", "nvs store"};
+
+/**
+ * @brief Adds one measurement to a stage
+ *
+ * @param stage PH_PROFILE_*
+ * @param elapsed cycles or us
+ */
+void dfrobotPHProfileRecord(byte stage, uint32_t elapsed) {
+    if (stage >= PH_PROFILE_STAGES)
+    {
+        return;
+    }
+    if (profileStages[stage].count == 0 || elapsed < profileStages[stage].min)
+    {
+        profileStages[stage].min = elapsed;
+    }
+    if (elapsed > profileStages[stage].max)
+    {
+        profileStages[stage].max = elapsed;
+    }
+    profileStages[stage].total += elapsed;
+    profileStages[stage].count++;
+}
+
+/**
+ * @brief Gets the timing of one stage
+ *
+ * @param stage PH_PROFILE_*
+ * @return DFRobotESPpHProfileStats all 0 for an unknown stage or one never measured
+ */
+DFRobotESPpHProfileStats dfrobotPHProfileStats(byte stage) {
+    DFRobotESPpHProfileStats stats = {0, 0, 0, 0};
+    if (stage < PH_PROFILE_STAGES && profileStages[stage].count > 0)
+    {
+        stats.count = profileStages[stage].count;
+        stats.min = profileStages[stage].min;
+        stats.average = (uint32_t)(profileStages[stage].total / profileStages[stage].count);
+        stats.max = profileStages[stage].max;
+    }
+    return stats;
+}
+
+/**
+ * @brief Clears all stages
+ */
+void dfrobotPHProfileReset() {
+    memset(profileStages, 0, sizeof(profileStages));
+}
+
+/**
+ * @brief Prints one line per stage
+ *
+ * @param output Any Print
+ */
+void dfrobotPHProfilePrint(Print &output) {
+#ifdef ARDUINO_ARCH_ESP32
+    output.println(F(">>>stage: count min/avg/max cycles<<<"));
+#else
+    output.println(F(">>>stage: count min/avg/max us<<<"));
+#endif
+    for (byte stage = 0; stage < PH_PROFILE_STAGES; stage++)
+    {
+        DFRobotESPpHProfileStats stats = dfrobotPHProfileStats(stage);
+        output.print(profileNames[stage]);
+        output.print(F(": "));
+        output.print(stats.count);
+        output.print(F(" "));
+        output.print(stats.min);
+        output.print(F("/"));
+        output.print(stats.average);
+        output.print(F("/"));
+        output.println(stats.max);
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * file dfrobot-esp-ph-profile.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Optional timing of the DFRobotESPpH pipeline stages
+ * Define DFROBOT_ESP_PH_PROFILE (in dfrobot-esp-ph.h or the build flags) to compile it in. Without it
+ * the PH_PROFILE_* macros expand to nothing and the functions below are empty inlines.
+ * On ESP32 the unit is CPU cycles (ESP.getCycleCount()), elsewhere microseconds.
+ * The counters are shared by all instances and not locked, a sample racing with a reset can be lost.
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#ifndef _DFROBOT_ESP_PH_PROFILE_H_
+#define _DFROBOT_ESP_PH_PROFILE_H_
+
+#include "Arduino.h"
+
+//stages, see dfrobotPHProfileStats()
+#define PH_PROFILE_ADC 0      //ADC conversions (analogRead() loop or DMA block read)
+#define PH_PROFILE_FILTER 1   //reduction of the oversampled readings and the PH_SMOOTH_* filter
+#define PH_PROFILE_SCALE 2    //ADC count to millivolts
+#define PH_PROFILE_CONVERT 3  //readPH(), millivolts to pH
+#define PH_PROFILE_NVS_LOAD 4 //calibration read in begin()
+#define PH_PROFILE_NVS_STORE 5 //calibration write
+#define PH_PROFILE_STAGES 6
+
+/**
+ * @brief Timing of one stage since the last reset
+ */
+typedef struct {
+    uint32_t count;   // measurements
+    uint32_t min;     // cycles or us, 0 when count is 0
+    uint32_t average;
+    uint32_t max;
+} DFRobotESPpHProfileStats;
+
+#ifdef DFROBOT_ESP_PH_PROFILE
+
+/**
+ * @brief Reads the profiling clock
+ *
+ * @return uint32_t cycles on ESP32, microseconds elsewhere
+ */
+static inline uint32_t dfrobotPHProfileNow() {
+#ifdef ARDUINO_ARCH_ESP32
+    return ESP.getCycleCount();
+#else
+    return micros();
+#endif
+}
+
+/**
+ * @brief Adds one measurement to a stage
+ *
+ * @param stage PH_PROFILE_*
+ * @param elapsed cycles or us
+ */
+void dfrobotPHProfileRecord(byte stage, uint32_t elapsed);
+
+/**
+ * @brief Gets the timing of one stage
+ *
+ * @param stage PH_PROFILE_*
+ * @return DFRobotESPpHProfileStats
+ */
+DFRobotESPpHProfileStats dfrobotPHProfileStats(byte stage);
+
+/**
+ * @brief Clears all stages
+ */
+void dfrobotPHProfileReset();
+
+/**
+ * @brief Prints one line per stage (count, min, average, max), also sent in reply to the PHPROF command
+ *
+ * @param output Any Print
+ */
+void dfrobotPHProfilePrint(Print &output);
+
+/**
+ * @brief Records the time from construction to the end of the enclosing block, for code with several returns
+ */
+class DFRobotESPpHProfileScope {
+public:
+    DFRobotESPpHProfileScope(byte stage) : _stage(stage), _start(dfrobotPHProfileNow()) {}
+    ~DFRobotESPpHProfileScope() { dfrobotPHProfileRecord(this->_stage, dfrobotPHProfileNow() - this->_start); }
+private:
+    byte _stage;
+    uint32_t _start;
+};
+
+#define PH_PROFILE_BEGIN(start) uint32_t start = dfrobotPHProfileNow()
+#define PH_PROFILE_END(stage, start) dfrobotPHProfileRecord((stage), dfrobotPHProfileNow() - (start))
+#define PH_PROFILE_SCOPE(stage) DFRobotESPpHProfileScope _profileScope((stage))
+
+#else
+
+static inline DFRobotESPpHProfileStats dfrobotPHProfileStats(byte stage) {
+    (void)stage;
+    DFRobotESPpHProfileStats stats = {0, 0, 0, 0};
+    return stats;
+}
+static inline void dfrobotPHProfileReset() {}
+static inline void dfrobotPHProfilePrint(Print &output) { (void)output; }
+
+#define PH_PROFILE_BEGIN(start)
+#define PH_PROFILE_END(stage, start)
+#define PH_PROFILE_SCOPE(stage)
+
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * file dfrobot-esp-ph-queue.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Command queue of DFRobotESPpH shared by all instances, lets any task post calibration commands
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+/**
+ * @brief One line posted by postCommand(), copied so the caller's buffer can be reused at once
+ */
+typedef struct {
+    DFRobotESPpH *probe;
+    char line[ReceivedBufferLength];
+} DFRobotESPpHCommand;
+
+static std::atomic<QueueHandle_t> commandQueue(NULL);
+static std::atomic<SemaphoreHandle_t> handleLock(NULL); // held from the receive of a line until it is handled, and by dropCommands()
+static std::atomic<SemaphoreHandle_t> postLock(NULL);   // held around each send, and by dropCommands() while it puts lines back
+
+/**
+ * @brief Gets the shared queue, creating it on the first call
+ *        Tasks racing on the first post each create one, the loser deletes its own
+ *
+ * @return QueueHandle_t NULL if it could not be allocated
+ */
+static QueueHandle_t dfrobotPHCommandQueue() {
+    QueueHandle_t queue = commandQueue.load(std::memory_order_acquire);
+    if (queue != NULL)
+    {
+        return queue;
+    }
+    QueueHandle_t created = xQueueCreate(PH_COMMAND_QUEUE_LENGTH, sizeof(DFRobotESPpHCommand));
+    if (created == NULL)
+    {
+        return NULL;
+    }
+    if (!commandQueue.compare_exchange_strong(queue, created, std::memory_order_acq_rel))
+    {
+        vQueueDelete(created); // queue now holds the winner's handle
+        return queue;
+    }
+    return created;
+}
+
+/**
+ * @brief Gets one of the queue locks, creating it on the first call like the queue itself
+ *
+ * @param lock handleLock or postLock
+ * @param recursive true for a mutex the holder can take again, a handler may destroy a probe
+ * @return SemaphoreHandle_t NULL if it could not be allocated
+ */
+static SemaphoreHandle_t dfrobotPHCommandLock(std::atomic<SemaphoreHandle_t> &lock, boolean recursive) {
+    SemaphoreHandle_t current = lock.load(std::memory_order_acquire);
+    if (current != NULL)
+    {
+        return current;
+    }
+    SemaphoreHandle_t created = recursive ? xSemaphoreCreateRecursiveMutex() : xSemaphoreCreateMutex();
+    if (created == NULL)
+    {
+        return NULL;
+    }
+    if (!lock.compare_exchange_strong(current, created, std::memory_order_acq_rel))
+    {
+        vSemaphoreDelete(created);
+        return current;
+    }
+    return created;
+}
+#endif
+
+/**
+ * @brief Queues a command line for a probe
+ *
+ * @param probe instance the command is for
+ * @param line command
+ * @param waitMs time to wait for room
+ * @return boolean false if the queue is full
+ */
+boolean DFRobotESPpH::postCommand(DFRobotESPpH &probe, const char *line, uint32_t waitMs) {
+#ifdef ARDUINO_ARCH_ESP32
+    QueueHandle_t queue = dfrobotPHCommandQueue();
+    SemaphoreHandle_t posting = dfrobotPHCommandLock(postLock, false);
+    if (queue == NULL || posting == NULL)
+    {
+        return false;
+    }
+    DFRobotESPpHCommand command;
+    command.probe = &probe;
+    strncpy(command.line, line, ReceivedBufferLength - 1);
+    command.line[ReceivedBufferLength - 1] = '\0';
+    // a full queue is polled, not waited on under the lock, so a dropCommands() behind it is not held up
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(waitMs);
+    for (;;)
+    {
+        xSemaphoreTake(posting, portMAX_DELAY);
+        BaseType_t sent = xQueueSend(queue, &command, 0);
+        xSemaphoreGive(posting);
+        if (sent == pdTRUE)
+        {
+            return true;
+        }
+        if (xTaskGetTickCount() - start >= wait)
+        {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+#else
+    (void)waitMs;
+    probe.handleCommand(line); // no other task to hand it to
+    return true;
+#endif
+}
+
+/**
+ * @brief Handles the queued lines
+ *
+ * @param waitMs time to wait for the first line
+ * @return byte lines handled
+ */
+byte DFRobotESPpH::processCommands(uint32_t waitMs) {
+#ifdef ARDUINO_ARCH_ESP32
+    QueueHandle_t queue = dfrobotPHCommandQueue();
+    SemaphoreHandle_t handling = dfrobotPHCommandLock(handleLock, true);
+    if (queue == NULL || handling == NULL)
+    {
+        return 0;
+    }
+    DFRobotESPpHCommand command;
+    byte handled = 0;
+    TickType_t wait = pdMS_TO_TICKS(waitMs);
+    // bounded, so a task posting without pause cannot keep the caller here forever
+    while (handled < PH_COMMAND_QUEUE_LENGTH && xQueuePeek(queue, &command, wait) == pdTRUE)
+    {
+        wait = 0;
+        // received under the lock, so dropCommands() cannot destroy the probe between the receive and the handling
+        xSemaphoreTakeRecursive(handling, portMAX_DELAY);
+        if (xQueueReceive(queue, &command, 0) == pdTRUE) // the peeked line may have been dropped meanwhile
+        {
+            command.probe->serviceStorage();
+            command.probe->handleCommand(command.line);
+            handled++;
+        }
+        xSemaphoreGiveRecursive(handling);
+    }
+    return handled;
+#else
+    (void)waitMs;
+    return 0;
+#endif
+}
+
+/**
+ * @brief Removes the lines queued for a probe, called by its destructor
+ *        Waits for a line being handled to finish. Lines for other probes are put back in their order;
+ *        posting is held off meanwhile, so the slots they came from are still free.
+ *
+ * @param probe instance going away
+ */
+void DFRobotESPpH::dropCommands(DFRobotESPpH *probe) {
+#ifdef ARDUINO_ARCH_ESP32
+    QueueHandle_t queue = commandQueue.load(std::memory_order_acquire);
+    if (queue == NULL)
+    {
+        return; // nothing was ever posted
+    }
+    SemaphoreHandle_t handling = dfrobotPHCommandLock(handleLock, true);
+    SemaphoreHandle_t posting = dfrobotPHCommandLock(postLock, false);
+    if (handling == NULL || posting == NULL)
+    {
+        return;
+    }
+    xSemaphoreTakeRecursive(handling, portMAX_DELAY); // same order as a handler that posts: handling, then posting
+    xSemaphoreTake(posting, portMAX_DELAY);
+    DFRobotESPpHCommand command;
+    for (UBaseType_t waiting = uxQueueMessagesWaiting(queue); waiting > 0; waiting--)
+    {
+        if (xQueueReceive(queue, &command, 0) != pdTRUE)
+        {
+            break;
+        }
+        if (command.probe != probe)
+        {
+            xQueueSend(queue, &command, 0); // cannot fail, nobody else sends or receives
+        }
+    }
+    xSemaphoreGive(posting);
+    xSemaphoreGiveRecursive(handling);
+#else
+    (void)probe;
+#endif
+}
@@ -0,0 +1,96 @@
+/*
+ * file dfrobot-esp-ph-reader.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Read-only pH probe holding only what a calibrated Gravity: Analog pH Sensor / Meter Kit V2 needs to measure
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph-reader.h"
+
+/**
+ * @brief Constructor, uncalibrated: the typical 4.0/7.0 voltages and 12-bit/3.3V scaling
+ * 
+ */
+DFRobotESPpHReader::DFRobotESPpHReader() {
+    float voltage[2] = {PH_DEFAULT_NEUTRAL_VOLTAGE, PH_DEFAULT_ACID_VOLTAGE};
+    float ph[2] = {7.0, 4.0};
+    this->_pin = 0;
+    this->_mvPerCount = 3300 / 4096.0;
+    this->_adcTable = NULL;
+    this->_calTemperature = 25.0;
+    this->_compTemperature = 25.0;
+    this->_compFactor = 1.0;
+    dfrobotPHSegmentsBuild(&this->_segments, voltage, ph, 2);
+}
+
+/**
+ * @brief Copies pin, scaling and calibration out of a full instance
+ * 
+ * @param source initialized and calibrated instance
+ */
+DFRobotESPpHReader::DFRobotESPpHReader(const DFRobotESPpH &source) {
+    this->_pin = source.PH_PIN;
+    this->_mvPerCount = source._mvPerCount;
+    this->_adcTable = source._adcTable;
+    this->_calTemperature = source._calTemperature;
+    this->_compTemperature = source._calTemperature;
+    this->_compFactor = 1.0;
+    this->_segments = source._segments;
+}
+
+/**
+ * @brief Loads a probe's calibration through a temporary full instance
+ * 
+ * @param PH_PIN_in analog pin
+ * @param ESPADC_in ADC full scale count
+ * @param ESPVOLTAGE_in ADC reference voltage in mV
+ * @param nvsKey blob key of the calibration
+ */
+void DFRobotESPpHReader::begin(int PH_PIN_in, float ESPADC_in, float ESPVOLTAGE_in, const char *nvsKey) {
+    DFRobotESPpH calibration;
+    calibration.init(PH_PIN_in, ESPADC_in, ESPVOLTAGE_in);
+    calibration.begin(nvsKey);
+    *this = DFRobotESPpHReader(calibration);
+}
+
+/**
+ * @brief Reads the pin once
+ * 
+ * @return float mV
+ */
+float DFRobotESPpHReader::getVoltage() {
+    int raw = analogRead(this->_pin);
+    if (this->_adcTable != NULL)
+    {
+        return dfrobotPHMillivoltsFromTable(this->_adcTable, PH_ADC_LUT_SIZE, raw);
+    }
+    return raw * this->_mvPerCount;
+}
+
+/**
+ * @brief Reads the pin and converts it to pH
+ * 
+ * @param temperature temperature of the water
+ * @return float
+ */
+float DFRobotESPpHReader::getPH(float temperature) {
+    return readPH(getVoltage(), temperature);
+}
+
+/**
+ * @brief Converts a voltage to pH
+ *        The Nernst correction scales the distance from pH 7, so it is applied after the segments
+ * 
+ * @param voltage mV
+ * @param temperature temperature of the water
+ * @return float
+ */
+float DFRobotESPpHReader::readPH(float voltage, float temperature) {
+    float drift = temperature - this->_compTemperature;
+    if (drift > PH_TEMPERATURE_THRESHOLD || drift < -PH_TEMPERATURE_THRESHOLD)
+    {
+        this->_compTemperature = temperature;
+        this->_compFactor = dfrobotPHNernstFactorFrom(temperature, this->_calTemperature);
+    }
+    return 7.0f + this->_compFactor * (dfrobotPHFromSegments(&this->_segments, voltage) - 7.0f);
+}
@@ -0,0 +1,73 @@
+/*
+ * file dfrobot-esp-ph-reader.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Read-only pH probe holding only what a calibrated Gravity: Analog pH Sensor / Meter Kit V2 needs to measure
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_READER_H_
+#define _DFROBOT_ESP_PH_READER_H_
+
+#include "dfrobot-esp-ph.h"
+
+/**
+ * @brief Minimal runtime view of a calibrated probe: pin, ADC scaling and the calibration segments
+ *        A few dozen bytes instead of a full DFRobotESPpH with its Preferences, command buffer, history
+ *        and calibration state. Copy it from a DFRobotESPpH, which only has to exist while calibrating,
+ *        or let begin() load it through a temporary one.
+ */
+class DFRobotESPpHReader {
+private:
+    uint8_t _pin;
+    float _mvPerCount;         // linear count to mV scaling
+    const uint16_t *_adcTable; // eFuse calibrated count to mV table, NULL for linear scaling
+    float _compTemperature;    // temperature _compFactor was computed for
+    float _compFactor;         // Nernst factor applied to (pH - 7)
+    float _calTemperature;     // temperature the calibration was taken at
+    DFRobotESPpHSegments _segments; // calibration at _calTemperature
+
+public:
+    DFRobotESPpHReader();
+    /**
+     * @brief Takes pin, scaling and calibration from a full instance
+     *        The source can be destroyed afterwards; take a new copy after recalibrating it
+     * 
+     * @param source Initialized and calibrated instance
+     */
+    explicit DFRobotESPpHReader(const DFRobotESPpH &source);
+    /**
+     * @brief Loads the calibration of one probe from NVS through a temporary DFRobotESPpH
+     *        The temporary lives on the stack for the duration of the call
+     * 
+     * @param PH_PIN_in Analog pin of the pH board
+     * @param ESPADC_in ADC full scale count
+     * @param ESPVOLTAGE_in ADC reference voltage in mV
+     * @param nvsKey Blob key the probe was calibrated under
+     */
+    void begin(int PH_PIN_in, float ESPADC_in, float ESPVOLTAGE_in, const char *nvsKey = PH_NVS_DEFAULT_KEY);
+    /**
+     * @brief Reads the pin once and converts the voltage to pH
+     * 
+     * @param temperature Temperature in degress celcius
+     * @return float 
+     */
+    float getPH(float temperature);
+    /**
+     * @brief Converts a voltage to pH, with the Nernst correction recomputed only when the temperature
+     *        moves by more than PH_TEMPERATURE_THRESHOLD
+     * 
+     * @param voltage Voltage value of pH sensor in mV
+     * @param temperature Temperature in degress celcius
+     * @return float 
+     */
+    float readPH(float voltage, float temperature);
+    /**
+     * @brief Reads the pin once
+     * 
+     * @return float mV
+     */
+    float getVoltage();
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * file dfrobot-esp-ph-telemetry.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Batches DFRobotESPpH readings into one compact JSON message
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph-telemetry.h"
+
+/**
+ * @brief Constructor, one message per minute until begin() says otherwise
+ * 
+ */
+DFRobotESPpHTelemetry::DFRobotESPpHTelemetry() {
+    this->_lastReading = 0;
+    this->_length = 0;
+    this->_buffer[0] = '\0';
+    begin(0, 60000);
+}
+
+/**
+ * @brief Sets the batch limits and starts an empty batch
+ * 
+ * @param samples readings per message, 0 for no limit
+ * @param periodMs time covered by a message, 0 for no limit
+ */
+void DFRobotESPpHTelemetry::begin(uint16_t samples, uint32_t periodMs) {
+    this->_samples = samples;
+    this->_periodMs = periodMs;
+    this->_count = 0;
+}
+
+/**
+ * @brief Adds a reading to the batch
+ * 
+ * @param reading sample to add
+ * @return boolean true if a message was completed
+ */
+boolean DFRobotESPpHTelemetry::add(const DFRobotESPpHReading &reading) {
+    if (reading.count == 0 || reading.count == this->_lastReading)
+    {
+        return false; // nothing sampled yet, or already added
+    }
+    this->_lastReading = reading.count;
+
+    float ph = reading.ph;
+    if (!(ph == ph))
+    {
+        return false; // NAN would poison the statistics of the whole batch
+    }
+    if (this->_count == 0)
+    {
+        this->_first = reading.timestamp;
+        this->_mean = 0;
+        this->_m2 = 0;
+        this->_min = ph;
+        this->_max = ph;
+        this->_voltageSum = 0;
+        this->_temperatureSum = 0;
+    }
+    if (this->_count < PH_TELEMETRY_MAX_SAMPLES)
+    {
+        float scaled = ph * 100.0f;
+        scaled = scaled > 32767 ? 32767 : (scaled < -32768 ? -32768 : scaled);
+        this->_ph[this->_count] = (int16_t)(scaled + (scaled >= 0 ? 0.5f : -0.5f));
+    }
+    this->_count++;
+    this->_last = reading.timestamp;
+    float delta = ph - this->_mean;
+    this->_mean += delta / this->_count;
+    this->_m2 += delta * (ph - this->_mean);
+    this->_min = ph < this->_min ? ph : this->_min;
+    this->_max = ph > this->_max ? ph : this->_max;
+    this->_voltageSum += reading.voltage;
+    this->_temperatureSum += reading.temperature;
+
+    if ((this->_samples != 0 && this->_count >= this->_samples)
+        || (this->_periodMs != 0 && this->_last - this->_first >= this->_periodMs))
+    {
+        format();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Completes the current batch
+ * 
+ * @return boolean false if there was nothing to send
+ */
+boolean DFRobotESPpHTelemetry::flush() {
+    if (this->_count == 0)
+    {
+        return false;
+    }
+    format();
+    return true;
+}
+
+/**
+ * @brief Gets the last message
+ * 
+ * @return const char* 
+ */
+const char *DFRobotESPpHTelemetry::json() {
+    return this->_buffer;
+}
+
+/**
+ * @brief Gets the length of the last message
+ * 
+ * @return size_t 
+ */
+size_t DFRobotESPpHTelemetry::length() {
+    return this->_length;
+}
+
+/**
+ * @brief Appends text to the message, cutting it at the buffer end
+ * 
+ * @param text NUL terminated
+ */
+void DFRobotESPpHTelemetry::append(const char *text) {
+    while (*text && this->_length < PH_TELEMETRY_BUFFER_SIZE - 1)
+    {
+        this->_buffer[this->_length++] = *text++;
+    }
+    this->_buffer[this->_length] = '\0';
+}
+
+/**
+ * @brief Appends an unsigned integer, all 32 bits exact (millis() timestamps do not fit a float)
+ * 
+ * @param value number
+ */
+void DFRobotESPpHTelemetry::appendUnsigned(uint32_t value) {
+    char text[11];
+    char *p = text + sizeof(text) - 1;
+    *p = '\0';
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    append(p);
+}
+
+/**
+ * @brief Appends a number with a fixed count of decimals, using integer arithmetic only
+ * 
+ * @param value number, clamped to what fits in 32 bits at the given precision
+ * @param decimals digits after the point, at most 3
+ */
+void DFRobotESPpHTelemetry::appendNumber(float value, byte decimals) {
+    static const int32_t scales[] = {1, 10, 100, 1000};
+    int32_t scale = scales[decimals > 3 ? 3 : decimals];
+    float scaled = value * scale;
+    if (!(scaled == scaled))
+    {
+        append("null"); // NAN has no JSON number
+        return;
+    }
+    scaled = scaled > 2.0e9f ? 2.0e9f : (scaled < -2.0e9f ? -2.0e9f : scaled);
+    int32_t fixed = (int32_t)(scaled + (scaled >= 0 ? 0.5f : -0.5f));
+
+    char text[16];
+    char *p = text + sizeof(text) - 1;
+    *p = '\0';
+    uint32_t magnitude = fixed < 0 ? -(uint32_t)fixed : fixed;
+    for (byte digit = 0; digit < decimals || magnitude > 0 || digit <= decimals; digit++)
+    {
+        if (digit == decimals && decimals > 0)
+        {
+            *--p = '.';
+        }
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    }
+    if (fixed < 0)
+    {
+        *--p = '-';
+    }
+    append(p);
+}
+
+/**
+ * @brief Writes the message of the current batch and starts a new batch
+ * 
+ */
+void DFRobotESPpHTelemetry::format() {
+    uint32_t count = this->_count;
+    this->_length = 0;
+    append("{\"t0\":");
+    appendUnsigned(this->_first);
+    append(",\"t1\":");
+    appendUnsigned(this->_last);
+    append(",\"n\":");
+    appendUnsigned(count);
+    if (count <= PH_TELEMETRY_MAX_SAMPLES)
+    {
+        append(",\"ph\":[");
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (i > 0)
+            {
+                append(",");
+            }
+            appendNumber(this->_ph[i] / 100.0f, 2);
+        }
+        append("]");
+    }
+    append(",\"mean\":");
+    appendNumber(this->_mean, 2);
+    append(",\"min\":");
+    appendNumber(this->_min, 2);
+    append(",\"max\":");
+    appendNumber(this->_max, 2);
+    append(",\"sd\":");
+    appendNumber(count > 1 ? sqrtf(this->_m2 / count) : 0, 3);
+    append(",\"mv\":");
+    appendNumber(this->_voltageSum / count, 1);
+    append(",\"temp\":");
+    appendNumber(this->_temperatureSum / count, 1);
+    append("}");
+    this->_count = 0;
+}
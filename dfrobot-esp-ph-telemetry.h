@@ -0,0 +1,89 @@
+/*
+ * file dfrobot-esp-ph-telemetry.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Batches DFRobotESPpH readings into one compact JSON message
+ *
+ * One message per batch, e.g. for MQTT:
+ *   {"t0":1200,"t1":61200,"n":4,"ph":[7.01,7.02,7.02,7.03],"mean":7.02,"min":7.01,"max":7.03,"sd":0.01,"mv":1498.7,"temp":24.5}
+ * t0/t1 are the millis() of the first and last reading, mean/min/max/sd are the pH statistics of the batch,
+ * mv and temp the batch means of voltage and temperature. "ph" holds every reading while they fit in
+ * PH_TELEMETRY_MAX_SAMPLES and is left out above that; the statistics always cover the whole batch.
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+
+#ifndef _DFROBOT_ESP_PH_TELEMETRY_H_
+#define _DFROBOT_ESP_PH_TELEMETRY_H_
+
+#include "dfrobot-esp-ph.h"
+
+#ifndef PH_TELEMETRY_MAX_SAMPLES
+#define PH_TELEMETRY_MAX_SAMPLES 32 //readings listed one by one in a message
+#endif
+#define PH_TELEMETRY_BUFFER_SIZE (200 + PH_TELEMETRY_MAX_SAMPLES * 8) //JSON text, worst case of every field
+
+/**
+ * @brief Accumulates readings until N samples or T milliseconds, then formats them into a preallocated buffer
+ *        No heap and no printf: numbers are formatted with integer arithmetic
+ */
+class DFRobotESPpHTelemetry {
+private:
+    uint16_t _samples;  // readings per batch, 0 for no count limit
+    uint32_t _periodMs; // batch length, 0 for no time limit
+    uint32_t _count;    // readings in the current batch
+    uint32_t _lastReading; // DFRobotESPpHReading.count of the last reading added
+    uint32_t _first;    // timestamp of the first reading
+    uint32_t _last;
+    float _mean;        // pH, Welford running mean
+    float _m2;          // pH, sum of squared deviations
+    float _min;
+    float _max;
+    float _voltageSum;
+    float _temperatureSum;
+    int16_t _ph[PH_TELEMETRY_MAX_SAMPLES]; // pH * 100
+    char _buffer[PH_TELEMETRY_BUFFER_SIZE];
+    size_t _length; // of the last message, 0 when none is ready
+
+    void format(); // write the message for the current batch and start a new one
+    void append(const char *text);
+    void appendNumber(float value, byte decimals);
+    void appendUnsigned(uint32_t value); // exact, for timestamps and counts
+
+public:
+    DFRobotESPpHTelemetry();
+    /**
+     * @brief Sets when a batch is complete, whichever limit comes first; also drops the current batch
+     * 
+     * @param samples Readings per message, 0 for no limit
+     * @param periodMs Time covered by a message, 0 for no limit
+     */
+    void begin(uint16_t samples, uint32_t periodMs);
+    /**
+     * @brief Adds one reading
+     *        Readings with the same count as the previous one (no new sample from latest()) are ignored
+     * 
+     * @param reading Sample, e.g. from DFRobotESPpH::latest()
+     * @return boolean true if this reading completed a batch and json() holds a new message
+     */
+    boolean add(const DFRobotESPpHReading &reading);
+    /**
+     * @brief Gets the last completed message, valid until the next batch completes
+     * 
+     * @return const char* NUL terminated JSON, empty before the first batch
+     */
+    const char *json();
+    /**
+     * @brief Gets the length of json()
+     * 
+     * @return size_t 
+     */
+    size_t length();
+    /**
+     * @brief Completes the current batch now, e.g. before deep sleep
+     * 
+     * @return boolean false if the batch is empty
+     */
+    boolean flush();
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * file dfrobot-esp-ph-ulp.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Deep sleep pH watch of DFRobotESPpH running on the ESP32 ULP coprocessor
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph.h"
+
+#ifdef DFROBOT_ESP_PH_HAS_ULP
+#include "esp32/ulp.h"
+#include "esp_sleep.h"
+#if __has_include("ulp_adc.h")
+#include "ulp_adc.h" // ESP-IDF 5, arduino-esp32 3.x
+#else
+#include "driver/adc.h"
+#endif
+
+#define PH_ULP_MAGIC 0x7048 //marks lowPowerState as written since power-on
+
+/**
+ * @brief Everything the watch needs after a wake-up, kept in RTC slow memory across deep sleep
+ */
+typedef struct {
+    uint16_t magic;
+    uint8_t channel;          // ADC1 channel of PH_PIN
+    uint8_t reserved;
+    DFRobotESPpHFixed fixed;  // count to pH, compensated at the temperature of the last getPH()
+    int32_t band;             // pH change that wakes the chip, Q16.16
+    uint32_t periodUs;
+    uint16_t low;             // the ULP wakes the chip below this count...
+    uint16_t high;            // ...or from this count on
+} DFRobotESPpHLowPower;
+
+RTC_DATA_ATTR static DFRobotESPpHLowPower lowPowerState;
+
+/**
+ * @brief Builds the watch program around the current thresholds, loads and starts it
+ *
+ * @return boolean false if the ULP could not be programmed
+ */
+static boolean lowPowerLoad() {
+    const uint8_t channel = lowPowerState.channel;
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, PH_ULP_DATA_WORD),
+        I_MOVI(R2, 0),
+        I_ADC(R1, 0, channel), // unrolled, the ULP has no cheap loop counter
+        I_ADDR(R2, R2, R1),
+        I_ADC(R1, 0, channel),
+        I_ADDR(R2, R2, R1),
+        I_ADC(R1, 0, channel),
+        I_ADDR(R2, R2, R1),
+        I_ADC(R1, 0, channel),
+        I_ADDR(R2, R2, R1),
+        I_RSHI(R0, R2, PH_ULP_SAMPLES_SHIFT),
+        I_ST(R0, R3, 0),
+        M_BL(1, lowPowerState.low),
+        M_BGE(1, lowPowerState.high),
+        I_HALT(),
+        M_LABEL(1),
+        I_WAKE(),
+        I_END(), // stop the ULP timer, the main core re-arms with resumeLowPower()
+        I_HALT(),
+    };
+    static_assert(PH_ULP_SAMPLES_SHIFT == 2, "the program above takes four samples");
+
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    if (ulp_process_macros_and_load(PH_ULP_PROGRAM_WORD, program, &size) != ESP_OK)
+    {
+        return false;
+    }
+    ulp_set_wakeup_period(0, lowPowerState.periodUs);
+    esp_sleep_enable_ulp_wakeup();
+    return ulp_run(PH_ULP_PROGRAM_WORD) == ESP_OK;
+}
+#endif
+
+/**
+ * @brief Arms the ULP to wake the chip once the pH leaves phBand around the current reading
+ *
+ * @param phBand pH change that wakes the chip
+ * @param periodMs ULP sampling period
+ * @return boolean false if the chip, pin or build has no ULP support
+ */
+boolean DFRobotESPpH::startLowPower(float phBand, uint32_t periodMs) {
+#ifdef DFROBOT_ESP_PH_HAS_ULP
+    int8_t channel = digitalPinToAnalogChannel(this->PH_PIN);
+    if (channel < 0 || channel > 7) // the ULP can only reach ADC1
+    {
+        return false;
+    }
+    stopTask();
+    stopStreaming();
+    uint32_t raw = (uint32_t)(readRaw() + 0.5f);
+
+#if __has_include("ulp_adc.h")
+    perimanClearPinBus(this->PH_PIN); // release the core's oneshot ADC unit, ulp_adc_init() claims its own
+    ulp_adc_cfg_t config = {};
+    config.adc_n = ADC_UNIT_1;
+    config.channel = (adc_channel_t)channel;
+    config.atten = ADC_ATTEN_DB_12;
+    config.width = ADC_BITWIDTH_12;
+    config.ulp_mode = ADC_ULP_MODE_FSM;
+    if (ulp_adc_init(&config) != ESP_OK)
+    {
+        return false;
+    }
+#else
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten((adc1_channel_t)channel, ADC_ATTEN_DB_11);
+    adc1_ulp_enable();
+#endif
+
+    lowPowerState.magic = PH_ULP_MAGIC;
+    lowPowerState.channel = channel;
+    lowPowerState.fixed = this->_fixed;
+    lowPowerState.band = (int32_t)(phBand * (1L << PH_FIXED_FRACTION_BITS));
+    lowPowerState.periodUs = periodMs * 1000;
+    dfrobotPHFixedRawBand(&lowPowerState.fixed, raw, lowPowerState.band, PH_ADC_LUT_SIZE - 1,
+                          &lowPowerState.low, &lowPowerState.high);
+    RTC_SLOW_MEM[PH_ULP_DATA_WORD] = raw;
+    return lowPowerLoad();
+#else
+    (void)phBand;
+    (void)periodMs;
+    return false;
+#endif
+}
+
+/**
+ * @brief Re-arms the ULP around the reading that woke the chip
+ *
+ * @return boolean false if startLowPower() was never called since power-on
+ */
+boolean DFRobotESPpH::resumeLowPower() {
+#ifdef DFROBOT_ESP_PH_HAS_ULP
+    if (lowPowerState.magic != PH_ULP_MAGIC)
+    {
+        return false;
+    }
+    uint32_t raw = RTC_SLOW_MEM[PH_ULP_DATA_WORD] & 0xFFFF; // the upper half holds the store instruction's PC
+    dfrobotPHFixedRawBand(&lowPowerState.fixed, raw, lowPowerState.band, PH_ADC_LUT_SIZE - 1,
+                          &lowPowerState.low, &lowPowerState.high);
+    return lowPowerLoad();
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Tells whether the pH watch woke the chip
+ *
+ * @return boolean
+ */
+boolean DFRobotESPpH::lowPowerWakeup() {
+#ifdef DFROBOT_ESP_PH_HAS_ULP
+    return lowPowerState.magic == PH_ULP_MAGIC && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Converts the last ULP reading to pH
+ *
+ * @return float 0 if startLowPower() was never called since power-on
+ */
+float DFRobotESPpH::lowPowerPH() {
+#ifdef DFROBOT_ESP_PH_HAS_ULP
+    if (lowPowerState.magic != PH_ULP_MAGIC)
+    {
+        return 0;
+    }
+    uint32_t raw = RTC_SLOW_MEM[PH_ULP_DATA_WORD] & 0xFFFF;
+    return dfrobotPHFixedToFloat(dfrobotPHFixedFromRaw(&lowPowerState.fixed, raw));
+#else
+    return 0;
+#endif
+}
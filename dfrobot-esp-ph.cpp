@@ -18,89 +18,1279 @@
  * date  2019-05
  */
 #include "dfrobot-esp-ph.h"
+#include "dfrobot-esp-ph-logger.h"
+#include <time.h>
 
+#ifdef ARDUINO_ARCH_ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+// critical section around the state processCommands() shares with the sampling path, a no-op without FreeRTOS
+// the _SAFE pair also works from an ISR, for the functions documented as ISR safe
+#ifdef ARDUINO_ARCH_ESP32
+#define PH_LOCK() portENTER_CRITICAL(&this->_lock)
+#define PH_UNLOCK() portEXIT_CRITICAL(&this->_lock)
+#define PH_LOCK_SAFE() portENTER_CRITICAL_SAFE(&this->_lock)
+#define PH_UNLOCK_SAFE() portEXIT_CRITICAL_SAFE(&this->_lock)
+#else
+#define PH_LOCK()
+#define PH_UNLOCK()
+#define PH_LOCK_SAFE()
+#define PH_UNLOCK_SAFE()
+#endif
+
+static Preferences sharedPreferences;
+static boolean sharedPreferencesOpen = false;
+
+// Nernst factors for the batch conversion, shared by all instances and filled on first use
+static float nernstTable[PH_NERNST_TABLE_SIZE];
+static boolean nernstTableReady = false;
+
+#ifdef DFROBOT_ESP_PH_HAS_ADC_LUT
+#include "esp_adc_cal.h"
+
+// full range attenuation, the arduino default; IDF 5 (arduino-esp32 3.x) renamed 11dB to 12dB
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define PH_ADC_ATTEN ADC_ATTEN_DB_12
+#else
+#define PH_ADC_ATTEN ADC_ATTEN_DB_11
+#endif
+
+// one extra entry so the conversion can interpolate at the top count without a bounds check
+static uint16_t adcMillivoltTable[PH_ADC_LUT_SIZE + 1];
+static boolean adcMillivoltTableReady = false;
+#endif
+
+/**
+ * @brief Gets the raw count to millivolt table, filling it from the eFuse ADC1 calibration on the first call
+ *        Assumes the arduino defaults of 12-bit width and full range attenuation
+ * 
+ * @return const uint16_t* PH_ADC_LUT_SIZE + 1 entries, NULL if the chip carries no eFuse calibration data
+ */
+const uint16_t *dfrobotPHAdcMillivoltTable() {
+#ifdef DFROBOT_ESP_PH_HAS_ADC_LUT
+    if (adcMillivoltTableReady)
+    {
+        return adcMillivoltTable;
+    }
+    esp_adc_cal_characteristics_t characteristics;
+    esp_adc_cal_value_t source = esp_adc_cal_characterize(ADC_UNIT_1, PH_ADC_ATTEN, ADC_WIDTH_BIT_12, 1100, &characteristics);
+    if (source == ESP_ADC_CAL_VAL_DEFAULT_VREF)
+    {
+        return NULL; // no eFuse data, the linear scaling is as good as a guessed Vref
+    }
+    for (uint32_t raw = 0; raw < PH_ADC_LUT_SIZE; raw++)
+    {
+        adcMillivoltTable[raw] = esp_adc_cal_raw_to_voltage(raw, &characteristics);
+    }
+    adcMillivoltTable[PH_ADC_LUT_SIZE] = adcMillivoltTable[PH_ADC_LUT_SIZE - 1];
+    adcMillivoltTableReady = true;
+    return adcMillivoltTable;
+#else
+    return NULL;
+#endif
+}
+
+
+/**
+ * @brief Gets the shared Preferences handle, opening it on the first call
+ * 
+ * @return Preferences& 
+ */
+Preferences &dfrobotPHPreferences() {
+    if (!sharedPreferencesOpen)
+    {
+        sharedPreferencesOpen = sharedPreferences.begin(PH_NVS_NAMESPACE, false);
+    }
+    return sharedPreferences;
+}
+
+/**
+ * @brief Reads and validates a calibration blob
+ * 
+ * @param key NVS key
+ * @param blob receives the record, zero-filled past the end of older layouts
+ * @return byte layout version, 0 if missing or corrupt
+ */
+byte dfrobotPHLoadCalibration(const char *key, DFRobotESPpHCalibrationBlob *blob) {
+    memset(blob, 0, sizeof(*blob));
+    size_t length = dfrobotPHPreferences().getBytes(key, blob, sizeof(*blob));
+    if (length < PH_CALIBRATION_V1_SIZE || blob->size != length)
+    {
+        return 0;
+    }
+    // older versions are a prefix of the current layout with the crc moved up to their end
+    uint16_t crc;
+    memcpy(&crc, (const uint8_t *)blob + length - sizeof(crc), sizeof(crc));
+    boolean valid = crc == dfrobotPHCrc16(blob, length - sizeof(crc))
+                    && ((blob->version == PH_CALIBRATION_VERSION && length == sizeof(*blob))
+                        || (blob->version == 2 && length == PH_CALIBRATION_V2_SIZE)
+                        || (blob->version == 1 && length == PH_CALIBRATION_V1_SIZE));
+    if (!valid)
+    {
+        memset(blob, 0, sizeof(*blob));
+        return 0;
+    }
+    return (byte)blob->version;
+}
+
+/**
+ * @brief Stamps a calibration blob with the current version, size and crc and writes it
+ * 
+ * @param key NVS key
+ * @param blob record, version, size and crc are filled in here
+ * @return boolean false if NVS refused the write
+ */
+boolean dfrobotPHStoreCalibration(const char *key, DFRobotESPpHCalibrationBlob *blob) {
+    blob->version = PH_CALIBRATION_VERSION;
+    blob->size = sizeof(*blob);
+    blob->crc = dfrobotPHCrc16(blob, offsetof(DFRobotESPpHCalibrationBlob, crc));
+    return dfrobotPHPreferences().putBytes(key, blob, sizeof(*blob)) == sizeof(*blob);
+}
 
 /**
  * @brief Initializes the pH sensor/hardware and assigns it the proper pins
  * 
- * @param PH_PIN_in Input for pH sensor on ESP32
- * @param ESPADC_in Input for ADC from ESP32
- * @param ESPVOLTAGE_in Input for ESP32 Voltage source
+ * @param PH_PIN_in Input for pH sensor on ESP32
+ * @param ESPADC_in Input for ADC from ESP32
+ * @param ESPVOLTAGE_in Input for ESP32 Voltage source
+ * @param useAdcCalibration use the eFuse calibrated lookup table when the chip provides one
+ */
+void DFRobotESPpH::init(int PH_PIN_in, float ESPADC_in, float ESPVOLTAGE_in, boolean useAdcCalibration) {
+    PH_PIN = PH_PIN_in;
+    this->_mvPerCount = ESPVOLTAGE_in / ESPADC_in;
+    this->_adcTable = useAdcCalibration ? dfrobotPHAdcMillivoltTable() : NULL;
+    updateCoefficients(); // the integer fit depends on the ADC scaling
+}
+
+/**
+ * @brief Retrieves the pH value of the tank/solution
+ * 
+ * @param temp_in Temperature of tank(in Celsius?)
+ * @return float
+ */
+float DFRobotESPpH::getPH(float temp_in) {
+    float raw = readRaw();
+    this->_raw = raw;
+    PH_PROFILE_BEGIN(scaleStart);
+    float voltage = rawToMillivolts(raw); // read the voltage
+    PH_PROFILE_END(PH_PROFILE_SCALE, scaleStart);
+    if (this->_smoothMode != PH_SMOOTH_NONE)
+    {
+        PH_PROFILE_BEGIN(smoothStart);
+        voltage = smoothVoltage(voltage);
+        PH_PROFILE_END(PH_PROFILE_FILTER, smoothStart);
+    }
+#ifdef DFROBOT_ESP_PH_DEBUG
+    if (this->_debug)
+    {
+        Serial.println(voltage);
+    }
+#endif
+    this->_voltage = voltage;
+    this->_temperature = temp_in;
+
+    // the trend holds one point per PH_STABILITY_INTERVAL_MS whatever the call rate, faster calls are averaged into it
+    unsigned long now = millis();
+    if (this->_trendRestart.exchange(false))
+    {
+        // ENTERPH: points from before the probe went into the buffer must not be captured
+        PH_LOCK();
+        this->_trend.clear();
+        PH_UNLOCK();
+        this->_bucketSum = 0;
+        this->_bucketCount = 0;
+        this->_lastSampleMs = 0;
+        this->_autoArmed = false;
+    }
+    this->_bucketSum += voltage;
+    this->_bucketCount++;
+    if (this->_lastSampleMs == 0 || now - this->_lastSampleMs >= PH_STABILITY_INTERVAL_MS)
+    {
+        this->_lastSampleMs = now | 1; // never 0, 0 means no previous point
+        PH_LOCK();
+        this->_trend.push(this->_bucketSum / this->_bucketCount, now); // fitted against its time, any spacing works
+        PH_UNLOCK();
+        this->_bucketSum = 0;
+        this->_bucketCount = 0;
+    }
+    if (this->_enterCalibrationFlag)
+    {
+        trackResponse();
+    }
+    if (this->_capturePending)
+    {
+        unsigned long deadline = this->_captureDeadlineMs;
+        boolean due = deadline != 0 && (long)(now - deadline) >= 0;
+        boolean stable = isStable();
+        if (deadline == 0)
+        {
+            // automatic: wait for the reading to move (probe moved to a buffer) and settle again
+            if (!stable && this->_trend.full())
+            {
+                this->_autoArmed = true;
+            }
+            else if (stable && this->_autoArmed)
+            {
+                this->_autoArmed = false;
+                captureCalibrationPoint();
+            }
+        }
+        else if (stable)
+        {
+            captureCalibrationPoint();
+        }
+        else if (due)
+        {
+            this->_console->println();
+            this->_console->println(F(">>>Reading not stable, captured anyway<<<"));
+            captureCalibrationPoint();
+        }
+    }
+
+    PH_PROFILE_BEGIN(convertStart);
+    readPH(voltage, temp_in); // convert voltage to pH with temperature compensation
+    PH_PROFILE_END(PH_PROFILE_CONVERT, convertStart);
+    PH_LOCK();
+    this->_history.push(this->_phValue);
+    PH_UNLOCK();
+    publishReading();
+    if (this->_logger != NULL)
+    {
+        this->_logger->log(this->_reading); // written by this task only, no need for the sequence lock
+    }
+    evaluateAlarms();
+    return this->_phValue;
+}
+
+/**
+ * @brief Publishes the last sample for latest()
+ *        Sequence lock: the counter is odd while the fields are written, readers retry if it changed
+ * 
+ */
+void DFRobotESPpH::publishReading() {
+    uint32_t sequence = this->_readingSequence.load(std::memory_order_relaxed);
+    this->_readingSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->_reading.raw = this->_raw;
+    this->_reading.voltage = this->_voltage;
+    this->_reading.ph = this->_phValue;
+    this->_reading.temperature = this->_temperature;
+    this->_reading.timestamp = millis();
+    this->_reading.count++;
+    PH_LOCK();
+    this->_reading.mean = this->_history.mean();
+    this->_reading.min = this->_history.min();
+    this->_reading.max = this->_history.max();
+    this->_reading.stddev = this->_history.stddev();
+    PH_UNLOCK();
+    this->_readingSequence.store(sequence + 2, std::memory_order_release);
+}
+
+/**
+ * @brief Reads the last published sample
+ *        A lower priority publisher preempted mid-write keeps the counter odd until it runs again,
+ *        so spinning alone could wait forever; after a few tries the reader gives up its time slice
+ * 
+ * @return DFRobotESPpHReading 
+ */
+DFRobotESPpHReading DFRobotESPpH::latest() {
+    DFRobotESPpHReading reading;
+    uint32_t before, after;
+#ifdef ARDUINO_ARCH_ESP32
+    byte tries = 0;
+#endif
+    do
+    {
+#ifdef ARDUINO_ARCH_ESP32
+        if (tries < PH_LATEST_SPIN_RETRIES)
+        {
+            tries++;
+        }
+        else
+        {
+            vTaskDelay(1);
+        }
+#endif
+        before = this->_readingSequence.load(std::memory_order_acquire);
+        reading = this->_reading;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = this->_readingSequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return reading;
+}
+
+/**
+ * @brief Gets the pH history and its rolling statistics
+ * 
+ * @return const DFRobotESPpHHistory<PH_HISTORY_LENGTH>& 
+ */
+const DFRobotESPpHHistory<PH_HISTORY_LENGTH> &DFRobotESPpH::getHistory() {
+    return this->_history;
+}
+
+/**
+ * @brief Drops the pH history
+ * 
+ */
+void DFRobotESPpH::clearHistory() {
+    PH_LOCK();
+    this->_history.clear();
+    PH_UNLOCK();
+}
+
+/**
+ * @brief Tells whether the voltage drift is below the stability threshold
+ * 
+ * @return boolean true if the reading has settled
+ */
+boolean DFRobotESPpH::isStable() {
+    if (!this->_trend.full())
+    {
+        return false;
+    }
+    float slope = getVoltageSlope();
+    return slope <= this->_stableSlope && slope >= -this->_stableSlope;
+}
+
+/**
+ * @brief Gets the voltage drift
+ * 
+ * @return float mV per second
+ */
+float DFRobotESPpH::getVoltageSlope() {
+    PH_LOCK();
+    float slope = this->_trend.slope();
+    PH_UNLOCK();
+    return slope;
+}
+
+/**
+ * @brief Sets the stability threshold
+ * 
+ * @param mvPerSecond maximum absolute drift in mV/s
+ */
+void DFRobotESPpH::setStabilityThreshold(float mvPerSecond) {
+    this->_stableSlope = mvPerSecond < 0 ? -mvPerSecond : mvPerSecond;
+}
+
+/**
+ * @brief Enables automatic capture of the buffer voltage
+ * 
+ * @param enable true to capture once stable without CALPH
+ */
+void DFRobotESPpH::setAutoCapture(boolean enable) {
+    this->_autoCapture = enable;
+}
+
+/**
+ * @brief Registers the alarm callback
+ * 
+ * @param callback function to call, NULL for none
+ * @param context passed back to the callback
+ */
+void DFRobotESPpH::setAlarmCallback(DFRobotESPpHAlarmCallback callback, void *context) {
+    this->_alarmCallback = callback;
+    this->_alarmContext = context;
+}
+
+/**
+ * @brief Sets the high pH alarm
+ * 
+ * @param limit pH, NAN to disable
+ * @param hysteresis pH below the limit at which the alarm clears
+ */
+void DFRobotESPpH::setHighAlarm(float limit, float hysteresis) {
+    this->_alarmHigh = limit;
+    this->_alarmHighHysteresis = hysteresis;
+    // the last sample against the new limit, with its hysteresis, so a raised alarm only clears when the reading allows it
+    float ph = this->_phValue;
+    boolean sampled = this->_reading.count != 0; // 7.0 before the first getPH() is no reading
+    updateAlarm(PH_ALARM_HIGH, sampled && ph > limit, isnan(limit) || ph < limit - hysteresis, PH_EVENT_HIGH, ph);
+}
+
+/**
+ * @brief Sets the low pH alarm
+ * 
+ * @param limit pH, NAN to disable
+ * @param hysteresis pH above the limit at which the alarm clears
+ */
+void DFRobotESPpH::setLowAlarm(float limit, float hysteresis) {
+    this->_alarmLow = limit;
+    this->_alarmLowHysteresis = hysteresis;
+    float ph = this->_phValue;
+    boolean sampled = this->_reading.count != 0;
+    updateAlarm(PH_ALARM_LOW, sampled && ph < limit, isnan(limit) || ph > limit + hysteresis, PH_EVENT_LOW, ph);
+}
+
+/**
+ * @brief Sets the rate of change alarm
+ * 
+ * @param limit pH per minute, NAN to disable
+ * @param hysteresis pH per minute below the limit at which the alarm clears
+ */
+void DFRobotESPpH::setRateAlarm(float limit, float hysteresis) {
+    this->_alarmRate = limit < 0 ? -limit : limit;
+    this->_alarmRateHysteresis = hysteresis;
+    float rate = getPHRate();
+    float magnitude = rate < 0 ? -rate : rate;
+    boolean measured = this->_trend.full(); // same condition as evaluateAlarms()
+    updateAlarm(PH_ALARM_RATE, measured && magnitude > this->_alarmRate,
+                isnan(limit) || (measured && magnitude < this->_alarmRate - hysteresis), PH_EVENT_RATE, rate);
+}
+
+/**
+ * @brief Gets the raised alarms
+ * 
+ * @return byte PH_ALARM_* bits
+ */
+byte DFRobotESPpH::getAlarmState() {
+    return this->_alarmState;
+}
+
+/**
+ * @brief Starts timing when the reading becomes unstable and stops when it is stable again
+ *        Called by getPH() in calibration mode, the result is taken by the next capture
+ * 
+ */
+void DFRobotESPpH::trackResponse() {
+    if (!this->_trend.full())
+    {
+        return;
+    }
+    boolean stable = isStable();
+    PH_LOCK(); // ENTERPH resets the timing from the command side
+    if (!stable && this->_settleStartMs == 0)
+    {
+        this->_settleStartMs = millis() | 1; // never 0, 0 means stable
+    }
+    else if (stable && this->_settleStartMs != 0)
+    {
+        this->_settleMs = millis() - this->_settleStartMs;
+        this->_settleStartMs = 0;
+    }
+    PH_UNLOCK();
+}
+
+/**
+ * @brief Gets the probe slope, offset and response time of the current calibration
+ * 
+ * @return DFRobotESPpHDiagnostics 
+ */
+DFRobotESPpHDiagnostics DFRobotESPpH::getDiagnostics() {
+    PH_LOCK();
+    DFRobotESPpHDiagnostics diagnostics = diagnose();
+    PH_UNLOCK();
+    return diagnostics;
+}
+
+/**
+ * @brief Computes the diagnostics from the calibration fields, the caller holds _lock
+ * 
+ * @return DFRobotESPpHDiagnostics 
+ */
+DFRobotESPpHDiagnostics DFRobotESPpH::diagnose() {
+    DFRobotESPpHDiagnostics diagnostics;
+    float nernst = PH_NERNST_SLOPE_MV * (this->_calTemperature + 273.15) / 298.15; // ideal probe mV per pH
+    float probeSlope = (this->_acidVoltage - this->_neutralVoltage) / (7.0 - 4.0) / PH_BOARD_GAIN;
+    diagnostics.nernstPercent = 100.0 * probeSlope / nernst;
+    diagnostics.offset = (this->_neutralVoltage - PH_BOARD_MIDPOINT_VOLTAGE) / PH_BOARD_GAIN;
+    diagnostics.responseMs = this->_responseMs;
+    diagnostics.temperature = this->_calTemperature;
+    diagnostics.timestamp = this->_calTimestamp;
+
+    float offset = fabsf(diagnostics.offset);
+    if (diagnostics.nernstPercent >= PH_HEALTH_SLOPE_GOOD_MIN && diagnostics.nernstPercent <= PH_HEALTH_SLOPE_GOOD_MAX
+        && offset <= PH_HEALTH_OFFSET_GOOD)
+    {
+        diagnostics.health = PH_PROBE_GOOD;
+    }
+    else if (diagnostics.nernstPercent >= PH_HEALTH_SLOPE_WORN_MIN && diagnostics.nernstPercent <= PH_HEALTH_SLOPE_WORN_MAX
+             && offset <= PH_HEALTH_OFFSET_WORN)
+    {
+        diagnostics.health = PH_PROBE_WORN;
+    }
+    else
+    {
+        diagnostics.health = PH_PROBE_REPLACE;
+    }
+    return diagnostics;
+}
+
+/**
+ * @brief Compares the sample just taken against the alarm limits
+ *        Disabled limits are NAN, every comparison with them is false
+ * 
+ */
+void DFRobotESPpH::evaluateAlarms() {
+    float ph = this->_phValue;
+    updateAlarm(PH_ALARM_HIGH, ph > this->_alarmHigh, ph < this->_alarmHigh - this->_alarmHighHysteresis,
+                PH_EVENT_HIGH, ph);
+    updateAlarm(PH_ALARM_LOW, ph < this->_alarmLow, ph > this->_alarmLow + this->_alarmLowHysteresis,
+                PH_EVENT_LOW, ph);
+    if (this->_trend.full() && !isnan(this->_alarmRate))
+    {
+        float rate = getPHRate();
+        float magnitude = rate < 0 ? -rate : rate;
+        updateAlarm(PH_ALARM_RATE, magnitude > this->_alarmRate,
+                    magnitude < this->_alarmRate - this->_alarmRateHysteresis, PH_EVENT_RATE, rate);
+    }
+}
+
+/**
+ * @brief Raises or clears one alarm and notifies the callback on a change
+ * 
+ * @param bit PH_ALARM_* bit
+ * @param raise the raise condition holds
+ * @param clear the clear condition (limit and hysteresis) holds
+ * @param event PH_EVENT_* raised, the cleared event follows it
+ * @param value passed to the callback
+ */
+void DFRobotESPpH::updateAlarm(byte bit, boolean raise, boolean clear, byte event, float value) {
+    if (!(this->_alarmState & bit) && raise)
+    {
+        this->_alarmState |= bit;
+    }
+    else if ((this->_alarmState & bit) && clear)
+    {
+        this->_alarmState &= ~bit;
+        event++; // PH_EVENT_*_CLEARED
+    }
+    else
+    {
+        return;
+    }
+    if (this->_alarmCallback != NULL)
+    {
+        this->_alarmCallback(*this, event, value, this->_alarmContext);
+    }
+}
+
+/**
+ * @brief Sets the temperature used by the background task
+ * 
+ * @param temperature temperature of the water
+ */
+void DFRobotESPpH::setTemperature(float temperature) {
+    this->_taskTemperature.store(temperature, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Body of the background sampling task
+ * 
+ * @param instance the DFRobotESPpH that started the task
+ */
+void DFRobotESPpH::taskEntry(void *instance) {
+#ifdef ARDUINO_ARCH_ESP32
+    DFRobotESPpH *self = (DFRobotESPpH *)instance;
+    TickType_t lastWake = xTaskGetTickCount();
+    while (self->_taskRunning.load(std::memory_order_relaxed))
+    {
+        self->getPH(self->_taskTemperature.load(std::memory_order_relaxed));
+        self->adaptTaskPeriod();
+        TickType_t period = pdMS_TO_TICKS(self->_taskPeriodMs);
+        vTaskDelayUntil(&lastWake, period > 0 ? period : 1);
+    }
+    self->_taskHandle = NULL;
+    vTaskDelete(NULL);
+#else
+    (void)instance;
+#endif
+}
+
+/**
+ * @brief Configures the adaptive task period
+ * 
+ * @param minMs shortest period, 0 for a fixed period
+ * @param maxMs longest period
+ * @param phPerMinute rate of change that counts as moving
+ * @param stddev history spread that counts as moving
+ */
+void DFRobotESPpH::setAdaptivePeriod(uint32_t minMs, uint32_t maxMs, float phPerMinute, float stddev) {
+    this->_adaptMinMs = minMs;
+    this->_adaptMaxMs = maxMs > minMs ? maxMs : minMs;
+    this->_adaptRate = phPerMinute < 0 ? -phPerMinute : phPerMinute;
+    this->_adaptStddev = stddev;
+    this->_adaptLastPH = NAN; // no step on the first sample
+}
+
+/**
+ * @brief Gets the current task period
+ * 
+ * @return uint32_t ms
+ */
+uint32_t DFRobotESPpH::getTaskPeriod() {
+    return this->_taskPeriodMs;
+}
+
+/**
+ * @brief Rate of change of the pH
+ * 
+ * @return float pH per minute, signed
+ */
+float DFRobotESPpH::getPHRate() {
+    return getVoltageSlope() * this->_compSlope * 60.0;
+}
+
+/**
+ * @brief Moves the task period towards the signal dynamics after a sample
+ *        Multiplicative steps react within a few samples at any period; the band between half and
+ *        the full thresholds holds the period, so it does not oscillate on a borderline signal
+ * 
+ */
+void DFRobotESPpH::adaptTaskPeriod() {
+    if (this->_adaptMinMs == 0)
+    {
+        return;
+    }
+    float rate = this->_trend.full() ? getPHRate() : 0;
+    rate = rate < 0 ? -rate : rate;
+    PH_LOCK(); // updateCoefficients() may clear the history from the command side
+    float stddev = this->_history.stddev();
+    PH_UNLOCK();
+    float activity = 0; // 1 at the thresholds
+    if (this->_adaptRate > 0)
+    {
+        activity = rate / this->_adaptRate;
+    }
+    if (this->_adaptStddev > 0 && stddev / this->_adaptStddev > activity)
+    {
+        activity = stddev / this->_adaptStddev;
+    }
+    // a step between two samples shows up here at once, long before a slow window notices it (never true for NAN)
+    float step = this->_phValue - this->_adaptLastPH;
+    step = step < 0 ? -step : step;
+    this->_adaptLastPH = this->_phValue;
+    if (this->_adaptStddev > 0 && step / (2 * this->_adaptStddev) > activity)
+    {
+        activity = step / (2 * this->_adaptStddev);
+    }
+
+    float period = this->_taskPeriodMs;
+    if (activity > 1)
+    {
+        period *= PH_ADAPT_FASTER;
+    }
+    else if (activity < 0.5)
+    {
+        period = period * PH_ADAPT_SLOWER + 1; // +1 so short periods still grow
+    }
+    if (period < this->_adaptMinMs)
+    {
+        period = this->_adaptMinMs;
+    }
+    else if (period > this->_adaptMaxMs)
+    {
+        period = this->_adaptMaxMs;
+    }
+    this->_taskPeriodMs = (uint32_t)period;
+}
+
+/**
+ * @brief Starts periodic sampling on a FreeRTOS task
+ * 
+ * @param periodMs sampling period
+ * @param core core to run on, -1 for any
+ * @param priority task priority
+ * @return boolean true if the task is running
+ */
+boolean DFRobotESPpH::startTask(uint32_t periodMs, int core, byte priority) {
+#ifdef ARDUINO_ARCH_ESP32
+    if (this->_taskHandle != NULL)
+    {
+        return false;
+    }
+    this->_taskPeriodMs = periodMs;
+    this->_taskRunning.store(true);
+    TaskHandle_t handle = NULL;
+    BaseType_t created = xTaskCreatePinnedToCore(taskEntry, "pH", PH_TASK_STACK_SIZE, this, priority, &handle,
+                                                 core < 0 ? tskNO_AFFINITY : (BaseType_t)core);
+    if (created != pdPASS)
+    {
+        this->_taskRunning.store(false);
+        return false;
+    }
+    this->_taskHandle = handle;
+    return true;
+#else
+    (void)periodMs;
+    (void)core;
+    (void)priority;
+    return false;
+#endif
+}
+
+/**
+ * @brief Stops the background sampling task
+ * 
+ */
+void DFRobotESPpH::stopTask() {
+#ifdef ARDUINO_ARCH_ESP32
+    if (this->_taskHandle == NULL)
+    {
+        return;
+    }
+    this->_taskRunning.store(false);
+    while (this->_taskHandle != NULL)
+    {
+        vTaskDelay(1); // the task exits after its current sample
+    }
+#endif
+}
+
+/**
+ * @brief Samples the pH pin once or several times and filters the result
+ * 
+ * @return float ADC count, fractional when several samples are averaged
+ */
+float DFRobotESPpH::readRaw() {
+    PH_PROFILE_BEGIN(adcStart);
+#ifdef DFROBOT_ESP_PH_HAS_STREAMING
+    if (this->_streaming)
+    {
+        adc_continuous_data_t *block = NULL;
+        if (analogContinuousRead(&block, 0)) // no wait, keep the previous block if nothing new is ready
+        {
+            this->_streamRaw = block[0].avg_read_raw;
+        }
+        PH_PROFILE_END(PH_PROFILE_ADC, adcStart);
+        return this->_streamRaw;
+    }
+#endif
+    byte count = this->_oversampleCount;
+    if (count <= 1)
+    {
+        float raw = analogRead(PH_PIN);
+        PH_PROFILE_END(PH_PROFILE_ADC, adcStart);
+        return raw;
+    }
+
+    uint16_t samples[PH_MAX_OVERSAMPLING];
+    uint32_t sum = 0;
+    for (byte i = 0; i < count; i++)
+    {
+        samples[i] = analogRead(PH_PIN);
+        sum += samples[i];
+    }
+    PH_PROFILE_END(PH_PROFILE_ADC, adcStart);
+    PH_PROFILE_SCOPE(PH_PROFILE_FILTER); // every return below
+    if (this->_oversampleMode == PH_OVERSAMPLE_MEAN)
+    {
+        return (float)sum / count;
+    }
+
+    // insertion sort, the buffer is at most PH_MAX_OVERSAMPLING entries
+    for (byte i = 1; i < count; i++)
+    {
+        uint16_t value = samples[i];
+        byte j = i;
+        while (j > 0 && samples[j - 1] > value)
+        {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = value;
+    }
+
+    if (this->_oversampleMode == PH_OVERSAMPLE_MEDIAN)
+    {
+        if (count & 1)
+        {
+            return samples[count / 2];
+        }
+        return (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+    }
+
+    // PH_OVERSAMPLE_TRIMMED_MEAN
+    byte trim = count / 4;
+    sum = 0;
+    for (byte i = trim; i < count - trim; i++)
+    {
+        sum += samples[i];
+    }
+    return (float)sum / (count - 2 * trim);
+}
+
+/**
+ * @brief Converts an ADC count to millivolts
+ *        Fractional counts from averaging are interpolated between the two neighbouring table entries
+ * 
+ * @param raw ADC count
+ * @return float voltage in mV
+ */
+float DFRobotESPpH::rawToMillivolts(float raw) {
+    if (this->_adcTable != NULL)
+    {
+        return dfrobotPHMillivoltsFromTable(this->_adcTable, PH_ADC_LUT_SIZE, raw);
+    }
+    return raw * this->_mvPerCount;
+}
+
+/**
+ * @brief Sets the number of ADC samples per reading and the filter used to combine them
+ * 
+ * @param samples number of samples, 1 reads the pin once
+ * @param mode PH_OVERSAMPLE_MEAN, PH_OVERSAMPLE_MEDIAN or PH_OVERSAMPLE_TRIMMED_MEAN
+ */
+void DFRobotESPpH::setOversampling(byte samples, byte mode) {
+    if (samples < 1)
+    {
+        samples = 1;
+    }
+    else if (samples > PH_MAX_OVERSAMPLING)
+    {
+        samples = PH_MAX_OVERSAMPLING;
+    }
+    this->_oversampleCount = samples;
+    this->_oversampleMode = mode;
+}
+
+/**
+ * @brief Selects the voltage filter and restarts it
+ * 
+ * @param mode PH_SMOOTH_NONE, PH_SMOOTH_EMA or PH_SMOOTH_KALMAN
+ */
+void DFRobotESPpH::setSmoothing(byte mode) {
+    this->_smoothMode = mode;
+    this->_smoothPrimed = false;
+}
+
+/**
+ * @brief Selects the exponential moving average
+ * 
+ * @param alpha weight of the new sample, clamped to (0, 1]
+ */
+void DFRobotESPpH::setSmoothingEMA(float alpha) {
+    if (!(alpha > 0))
+    {
+        alpha = PH_SMOOTH_DEFAULT_ALPHA;
+    }
+    else if (alpha > 1)
+    {
+        alpha = 1;
+    }
+    this->_smoothAlpha = alpha;
+    setSmoothing(PH_SMOOTH_EMA);
+}
+
+/**
+ * @brief Selects the 1-D Kalman filter
+ * 
+ * @param processNoise variance of the real change per sample, mV^2
+ * @param measurementNoise variance of the ADC noise, mV^2
+ */
+void DFRobotESPpH::setSmoothingKalman(float processNoise, float measurementNoise) {
+    this->_smoothProcessNoise = processNoise > 0 ? processNoise : PH_SMOOTH_DEFAULT_PROCESS_NOISE;
+    this->_smoothMeasurementNoise = measurementNoise > 0 ? measurementNoise : PH_SMOOTH_DEFAULT_MEASUREMENT_NOISE;
+    setSmoothing(PH_SMOOTH_KALMAN);
+}
+
+/**
+ * @brief Filters one voltage, the first sample after a restart is taken as is
+ * 
+ * @param voltage sampled voltage in mV
+ * @return float filtered voltage in mV
+ */
+float DFRobotESPpH::smoothVoltage(float voltage) {
+    if (!this->_smoothPrimed)
+    {
+        this->_smoothPrimed = true;
+        this->_smoothVoltage = voltage;
+        this->_smoothVariance = this->_smoothMeasurementNoise; // as uncertain as a single sample
+        return voltage;
+    }
+    if (this->_smoothMode == PH_SMOOTH_EMA)
+    {
+        this->_smoothVoltage += this->_smoothAlpha * (voltage - this->_smoothVoltage);
+    }
+    else
+    {
+        // PH_SMOOTH_KALMAN, constant model: predict, then blend in the sample by its weight
+        float variance = this->_smoothVariance + this->_smoothProcessNoise;
+        float gain = variance / (variance + this->_smoothMeasurementNoise);
+        this->_smoothVoltage += gain * (voltage - this->_smoothVoltage);
+        this->_smoothVariance = (1 - gain) * variance;
+    }
+    return this->_smoothVoltage;
+}
+
+/**
+ * @brief Starts background DMA sampling of the pH pin
+ * 
+ * @param sampleRateHz ADC conversion rate
+ * @param conversionsPerBlock number of conversions averaged per block
+ * @return boolean true if the continuous driver is running
+ */
+boolean DFRobotESPpH::startStreaming(uint32_t sampleRateHz, uint32_t conversionsPerBlock) {
+#ifdef DFROBOT_ESP_PH_HAS_STREAMING
+    if (this->_streaming)
+    {
+        stopStreaming();
+    }
+    this->_streamRaw = analogRead(PH_PIN); // seed the value returned until the first block completes
+    uint8_t pin = PH_PIN;
+    if (!analogContinuous(&pin, 1, conversionsPerBlock, sampleRateHz, NULL))
+    {
+        return false;
+    }
+    if (!analogContinuousStart())
+    {
+        analogContinuousDeinit();
+        return false;
+    }
+    this->_streaming = true;
+    return true;
+#else
+    (void)sampleRateHz;
+    (void)conversionsPerBlock;
+    return false;
+#endif
+}
+
+/**
+ * @brief Stops background DMA sampling of the pH pin
+ * 
+ */
+void DFRobotESPpH::stopStreaming() {
+#ifdef DFROBOT_ESP_PH_HAS_STREAMING
+    if (this->_streaming)
+    {
+        analogContinuousStop();
+        analogContinuousDeinit();
+        this->_streaming = false;
+    }
+#endif
+}
+
+/**
+ * @brief Turns the getPH() voltage trace on or off
+ * 
+ * @param enable true to print each voltage read to Serial
+ */
+void DFRobotESPpH::setDebug(boolean enable) {
+#ifdef DFROBOT_ESP_PH_DEBUG
+    this->_debug = enable;
+#else
+    (void)enable;
+#endif
+}
+
+/**
+ * @brief Constructor that assigns default(neutral) values to pH sensor metrics
+ * 
+ */
+DFRobotESPpH::DFRobotESPpH()
+{
+    this->_temperature = 25.0;
+    this->_compTemperature = 25.0;
+    this->_phValue = 7.0;
+    this->_acidVoltage = PH_DEFAULT_ACID_VOLTAGE;
+    this->_neutralVoltage = PH_DEFAULT_NEUTRAL_VOLTAGE;
+    this->_voltage = PH_DEFAULT_NEUTRAL_VOLTAGE;
+    this->_oversampleCount = 1;
+    this->_oversampleMode = PH_OVERSAMPLE_MEAN;
+    this->_smoothMode = PH_SMOOTH_NONE;
+    this->_smoothPrimed = false;
+    this->_smoothVoltage = 0;
+    this->_smoothVariance = 0;
+    this->_smoothAlpha = PH_SMOOTH_DEFAULT_ALPHA;
+    this->_smoothProcessNoise = PH_SMOOTH_DEFAULT_PROCESS_NOISE;
+    this->_smoothMeasurementNoise = PH_SMOOTH_DEFAULT_MEASUREMENT_NOISE;
+    this->_streaming = false;
+    this->_streamRaw = 0;
+    this->_raw = 0;
+    this->_logger = NULL;
+    this->_mvPerCount = 0;
+    this->_adcTable = NULL;
+    this->_pendingWrite = false;
+    this->_lastCommitMs = 0;
+    this->_manualState = PH_MANUAL_IDLE;
+    this->_manualNeutralVoltage = 0;
+    this->_lastSampleMs = 0;
+    this->_bucketSum = 0;
+    this->_bucketCount = 0;
+    this->_captureDeadlineMs = 0;
+    this->_stableSlope = PH_STABLE_SLOPE_MV_PER_S;
+    this->_autoCapture = false;
+    this->_capturePending = false;
+    this->_trendRestart = false;
+    this->_autoArmed = false;
+    this->_enterCalibrationFlag = 0;
+    this->_phCalibrationFinish = 0;
+    this->_captureTargetPH = 0;
+    this->_capturedPH = 0;
+    this->_capturedVoltage = 0;
+#ifdef ARDUINO_ARCH_ESP32
+    portMUX_INITIALIZE(&this->_lock);
+#endif
+    this->_calTemperature = 25.0;
+    this->_calTimestamp = 0;
+    this->_responseMs = 0;
+    this->_sessionResponseMs = 0;
+    this->_settleStartMs = 0;
+    this->_settleMs = 0;
+    this->_extraCount = 0;
+    this->_alarmCallback = NULL;
+    this->_alarmContext = NULL;
+    this->_alarmHigh = NAN;
+    this->_alarmHighHysteresis = 0;
+    this->_alarmLow = NAN;
+    this->_alarmLowHysteresis = 0;
+    this->_alarmRate = NAN;
+    this->_alarmRateHysteresis = 0;
+    this->_alarmState = 0;
+    setBufferWindows(NULL, 0);
+    this->_readingSequence.store(0);
+    memset(&this->_reading, 0, sizeof(this->_reading));
+    this->_taskTemperature.store(25.0);
+    this->_taskRunning.store(false);
+    this->_taskHandle = NULL;
+    this->_taskPeriodMs = 0;
+    this->_adaptMinMs = 0;
+    this->_adaptMaxMs = 0;
+    this->_adaptRate = 0;
+    this->_adaptStddev = 0;
+    this->_adaptLastPH = NAN;
+    this->_cmdStream = &Serial;
+    this->_console = &Serial;
+    this->_cmdReceivedTimeOut = 0;
+    this->_cmdReceivedBufferIndex = 0;
+    this->_cmdDiscarding = false;
+    this->_cmdReceivedBuffer[0] = '\0';
+    strcpy(this->_nvsKey, PH_NVS_DEFAULT_KEY);
+#ifdef DFROBOT_ESP_PH_DEBUG
+    this->_debug = true;
+#endif
+    updateCoefficients();
+}
+
+/**
+ * @brief Destructor
+ * 
+ */
+DFRobotESPpH::~DFRobotESPpH()
+{
+    stopTask();
+    stopStreaming();
+    dropCommands(this);
+}
+
+/**
+ * @brief Gets the neutral voltage of tank/solution
+ * 
+ * @return float 
+ */
+float DFRobotESPpH::get_neutralVoltage(){
+	return this->_neutralVoltage;
+}
+
+/**
+ * @brief Gets the ADC count of the last reading
+ * 
+ * @return float 
+ */
+float DFRobotESPpH::getRaw() {
+    return this->_raw;
+}
+
+/**
+ * @brief Gets the voltage of the last reading
+ * 
+ * @return float mV
+ */
+float DFRobotESPpH::getVoltage() {
+    return this->_voltage;
+}
+
+/**
+ * @brief Gets the temperature of the last reading
+ * 
+ * @return float C
  */
-void DFRobotESPpH::init(int PH_PIN_in, float ESPADC_in, int ESPVOLTAGE_in) {
-    PH_PIN = PH_PIN_in;
-    ESPADC = ESPADC_in;
-    ESPVOLTAGE = ESPVOLTAGE_in;
+float DFRobotESPpH::getTemperature() {
+    return this->_temperature;
 }
 
 /**
- * @brief Retrieves the pH value of the tank/solution
+ * @brief Sets the logger getPH() passes each sample to
  * 
- * @param temp_in Temperature of tank(in Celsius?)
- * @return float
+ * @param logger logger, NULL for none
  */
-float DFRobotESPpH::getPH(float temp_in) {
-    float voltage = analogRead(PH_PIN) / ESPADC * ESPVOLTAGE; // read the voltage
-    Serial.println(voltage);
-    this->_voltage = voltage;
-    this->_temperature = temp_in;
-    return readPH(voltage, temp_in); // convert voltage to pH with temperature compensation
+void DFRobotESPpH::setLogger(DFRobotESPpHLogger *logger) {
+    this->_logger = logger;
 }
 
 /**
- * @brief Constructor that assigns default(neutral) values to pH sensor metrics
+ * @brief This is the startup function for the pH sensor. It gets everything ready so that the sensor can actually start to calibrate/read values
  * 
+ * @param nvsKey key of this probe's calibration blob
  */
-DFRobotESPpH::DFRobotESPpH()
+void DFRobotESPpH::begin(const char *nvsKey)
 {
-    this->_temperature = 25.0;
-    this->_phValue = 7.0;
-    this->_acidVoltage = 1844.17;   //buffer solution 4.0 at 25C
-    this->_neutralVoltage = 1348.68; //buffer solution 7.0 at 25C
-    this->_voltage = 1348.68;
+    strncpy(this->_nvsKey, nvsKey, PH_NVS_KEY_LENGTH - 1);
+    this->_nvsKey[PH_NVS_KEY_LENGTH - 1] = '\0';
+
+    PH_PROFILE_BEGIN(loadStart);
+    Preferences &preferences = dfrobotPHPreferences();
+    DFRobotESPpHCalibrationBlob blob;
+    byte version = dfrobotPHLoadCalibration(this->_nvsKey, &blob);
+    this->_extraCount = 0;
+    this->_responseMs = 0;
+    if (version != 0)
+    {
+        this->_neutralVoltage = blob.neutralVoltage;
+        this->_acidVoltage = blob.acidVoltage;
+        this->_calTemperature = blob.temperature;
+        this->_calTimestamp = blob.timestamp;
+        if (version >= 2) // version 1 was a two-point record
+        {
+            this->_extraCount = blob.extraCount <= PH_MAX_CAL_POINTS - 2 ? blob.extraCount : 0;
+            memcpy(this->_extraVoltage, blob.extraVoltage, sizeof(this->_extraVoltage));
+            memcpy(this->_extraPH, blob.extraPH, sizeof(this->_extraPH));
+        }
+        if (version >= 3) // the slope and offset are recomputed from the voltages, only the response time is read
+        {
+            this->_responseMs = blob.responseMs;
+        }
+        if (version != PH_CALIBRATION_VERSION)
+        {
+            this->_pendingWrite = true; // rewrite in the current layout
+        }
+    }
+    else
+    {
+        // no blob yet, or a corrupt one: fall back to the per-key values of older versions
+        this->_neutralVoltage = preferences.getFloat("voltage7", 0); //load the neutral (pH = 7.0)voltage of the pH board from the EEPROM
+        this->_acidVoltage = preferences.getFloat("voltage4", 0); //load the acid (pH = 4.0) voltage of the pH board from the EEPROM
+        if (this->_neutralVoltage != 0 && this->_acidVoltage != 0)
+        {
+            this->_pendingWrite = true; // migrate to a blob
+        }
+        if (this->_neutralVoltage == 0)
+        {
+            this->_neutralVoltage = PH_DEFAULT_NEUTRAL_VOLTAGE; // new EEPROM, use typical voltage (nothing is written until calibrated)
+        }
+        if (this->_acidVoltage == 0)
+        {
+            this->_acidVoltage = PH_DEFAULT_ACID_VOLTAGE; // new EEPROM, use typical voltage (nothing is written until calibrated)
+        }
+    }
+    PH_PROFILE_END(PH_PROFILE_NVS_LOAD, loadStart);
+    updateCoefficients();
 }
 
 /**
- * @brief Destructor
+ * @brief Writes pending calibration values if the throttle interval allows it
  * 
  */
-DFRobotESPpH::~DFRobotESPpH()
-{
+void DFRobotESPpH::serviceStorage() {
+    if (this->_pendingWrite)
+    {
+        flushCalibration(false);
+    }
 }
 
 /**
- * @brief Gets the neutral voltage of tank/solution
+ * @brief Writes the calibration values changed since the last write
  * 
- * @return float 
+ * @param force write even if the last write was less than PH_NVS_COMMIT_INTERVAL_MS ago
  */
-float DFRobotESPpH::get_neutralVoltage(){
-	return this->_neutralVoltage;
+void DFRobotESPpH::flushCalibration(boolean force) {
+    if (!this->_pendingWrite)
+    {
+        return;
+    }
+    if (!force && this->_lastCommitMs != 0 && millis() - this->_lastCommitMs < PH_NVS_COMMIT_INTERVAL_MS)
+    {
+        return; // coalesced into the next write
+    }
+    DFRobotESPpHCalibrationBlob blob;
+    memset(&blob, 0, sizeof(blob));
+    // snapshot under the lock, a capture on the sampling task cannot tear it; the NVS write runs outside
+    PH_LOCK();
+    blob.neutralVoltage = this->_neutralVoltage;
+    blob.acidVoltage = this->_acidVoltage;
+    blob.slope = this->_slope;
+    blob.intercept = this->_intercept;
+    blob.temperature = this->_calTemperature;
+    blob.timestamp = this->_calTimestamp;
+    blob.extraCount = this->_extraCount;
+    memcpy(blob.extraVoltage, this->_extraVoltage, sizeof(blob.extraVoltage));
+    memcpy(blob.extraPH, this->_extraPH, sizeof(blob.extraPH));
+    DFRobotESPpHDiagnostics diagnostics = diagnose();
+    blob.nernstPercent = diagnostics.nernstPercent;
+    blob.offset = diagnostics.offset;
+    blob.responseMs = diagnostics.responseMs;
+    this->_pendingWrite = false; // a change after the snapshot sets it again
+    PH_UNLOCK();
+    PH_PROFILE_BEGIN(storeStart);
+    dfrobotPHStoreCalibration(this->_nvsKey, &blob);
+    PH_PROFILE_END(PH_PROFILE_NVS_STORE, storeStart);
+    this->_lastCommitMs = millis() | 1; // never 0, 0 means nothing written yet
 }
 
 /**
- * @brief This is the startup function for the pH sensor. It gets everything ready so that the sensor can actually start to calibrate/read values
+ * @brief Recomputes the cached slope and intercept from the calibration voltages
+ *        The two-point fit through (neutral, 7.0) and (acid, 4.0) reduces to pH = slope * voltage + intercept,
+ *        so readPH() only has to do one multiply-add per sample
  * 
  */
-void DFRobotESPpH::begin()
-{
-	preferences.begin("pHVals", false);
-    //check if calibration values (neutral and acid) are stored in eeprom
-    //preferences.putFloat("voltage7", this->_neutralVoltage);
-    this->_neutralVoltage = preferences.getFloat("voltage7", 0); //load the neutral (pH = 7.0)voltage of the pH board from the EEPROM
-    if (this->_neutralVoltage == 0)
+void DFRobotESPpH::updateCoefficients() {
+    PH_LOCK();
+    float slope = (7.0 - 4.0) / (this->_neutralVoltage - this->_acidVoltage);
+    if (isfinite(slope)) // equal voltages (a corrupt record) keep the previous fit
+    {
+        this->_slope = slope;
+        this->_intercept = 7.0 - slope * this->_neutralVoltage;
+    }
+
+    // piecewise fit through every buffer, a single segment equal to the fit above for two points
+    float voltage[PH_MAX_CAL_POINTS] = {this->_neutralVoltage, this->_acidVoltage};
+    float ph[PH_MAX_CAL_POINTS] = {7.0, 4.0};
+    for (byte i = 0; i < this->_extraCount; i++)
     {
-        this->_neutralVoltage = 1348.68; // new EEPROM, write typical voltage
-        preferences.putFloat("voltage7", this->_neutralVoltage);
+        voltage[2 + i] = this->_extraVoltage[i];
+        ph[2 + i] = this->_extraPH[i];
     }
+    DFRobotESPpHSegments segments;
+    if (dfrobotPHSegmentsBuild(&segments, voltage, ph, 2 + this->_extraCount) != 0)
+    {
+        this->_segments = segments;
+    } // else fewer than two distinct voltages, the previous segments stay
+    this->_history.clear(); // values from the old calibration are not comparable
+
+    updateTemperatureCompensation(this->_compTemperature);
+    PH_UNLOCK();
+}
+
+/**
+ * @brief Applies the Nernst correction for a temperature to the cached fit
+ *        pH = 7 + factor * (slope * voltage + intercept - 7), folded back into one slope and intercept.
+ *        The factor is taken relative to the calibration temperature, updateCoefficients() runs this
+ *        again whenever that changes
+ * 
+ * @param temperature temperature of the water
+ */
+void DFRobotESPpH::updateTemperatureCompensation(float temperature) {
+    float factor = dfrobotPHNernstFactorFrom(temperature, this->_calTemperature);
+    this->_compTemperature = temperature;
+    this->_compSlope = factor * this->_slope;
+    this->_compIntercept = 7.0 + factor * (this->_intercept - 7.0);
+    dfrobotPHSegmentsCompensate(&this->_compSegments, &this->_segments, factor);
 
-    //preferences.putFloat("voltage4", this->_acidVoltage);
-    this->_acidVoltage = preferences.getFloat("voltage4", 0); //load the acid (pH = 4.0) voltage of the pH board from the EEPROM
-    if (this->_acidVoltage == 0)
+    // the integer path works on raw counts, so fold the count to mV scaling (mV = gain * raw + offset) into the fit
+    float gain = this->_mvPerCount;
+    float offset = 0;
+    if (this->_adcTable != NULL)
     {
-        this->_acidVoltage = 1844.17; // new EEPROM, write typical voltage
-        preferences.putFloat("voltage4", this->_acidVoltage);
+        // straight line through the table at 1/8 and 7/8 of the range, where the ADC is close to linear
+        const uint16_t low = PH_ADC_LUT_SIZE / 8;
+        const uint16_t high = PH_ADC_LUT_SIZE - PH_ADC_LUT_SIZE / 8;
+        gain = (float)(this->_adcTable[high] - this->_adcTable[low]) / (high - low);
+        offset = this->_adcTable[low] - gain * low;
     }
-	preferences.end();
+    this->_fixed = dfrobotPHFixedFromFloat(this->_compSlope * gain, this->_compSlope * offset + this->_compIntercept);
 }
 
 /**
@@ -111,23 +1301,98 @@ void DFRobotESPpH::begin()
  * @return float 
  */
 float DFRobotESPpH::readPH(float voltage, float temperature) {
-
-    float slope = (7.0 - 4.0) / ((this->_neutralVoltage - 1500.0) / 3.0 - (this->_acidVoltage - 1500.0) / 3.0);
-    float intercept = 7.0 - slope * (this->_neutralVoltage - 1500.0) / 3.0;
-    this->_phValue = slope * (voltage - 1500.0) / 3.0 + intercept;
+    PH_LOCK();
+    float delta = temperature - this->_compTemperature;
+    if (delta > PH_TEMPERATURE_THRESHOLD || delta < -PH_TEMPERATURE_THRESHOLD)
+    {
+        updateTemperatureCompensation(temperature);
+    }
+    this->_phValue = dfrobotPHFromSegments(&this->_compSegments, voltage);
+    PH_UNLOCK();
     return _phValue;
 }
 
+/**
+ * @brief Reads the pH level from a raw ADC count without floating point
+ * 
+ * @param raw ADC count
+ * @return int32_t pH value, Q16.16
+ */
+int32_t DFRobotESPpH::readPHFixed(uint16_t raw) {
+    PH_LOCK_SAFE(); // may be called from an ISR, where portENTER_CRITICAL() aborts
+    DFRobotESPpHFixed fixed = this->_fixed;
+    PH_UNLOCK_SAFE();
+    return dfrobotPHFixedFromRaw(&fixed, raw);
+}
+
+/**
+ * @brief Gets the integer conversion constants
+ * 
+ * @return const DFRobotESPpHFixed& 
+ */
+const DFRobotESPpHFixed &DFRobotESPpH::getFixedCoefficients() {
+    return this->_fixed;
+}
+
+/**
+ * @brief Reads pH levels for a whole series of voltages
+ * 
+ * @param voltage voltages of the pH board
+ * @param temperature temperatures of the water, one per voltage
+ * @param out pH values
+ * @param n number of samples
+ */
+void DFRobotESPpH::readPH(const float *voltage, const float *temperature, float *out, size_t n) {
+    if (n == 0)
+    {
+        return;
+    }
+    // the loops below run on copies, the lock is held for the copy only however large n is
+    DFRobotESPpHSegments segments;
+    PH_LOCK();
+    segments = temperature == NULL ? this->_compSegments : this->_segments;
+    float calTemperature = this->_calTemperature;
+    PH_UNLOCK();
+    if (temperature == NULL)
+    {
+        if (segments.count == 1)
+        {
+            dfrobotPHFromVoltageBatch(segments.slope[0], segments.intercept[0], voltage, out, n);
+        }
+        else
+        {
+            dfrobotPHFromSegmentsBatch(&segments, voltage, out, n);
+        }
+    }
+    else
+    {
+        if (!nernstTableReady)
+        {
+            dfrobotPHNernstTableInit(nernstTable);
+            nernstTableReady = true;
+        }
+        // the table corrects from 25C, move the fit from the calibration temperature to 25C first
+        dfrobotPHSegmentsCompensate(&segments, &segments, (float)((calTemperature + 273.15) / PH_NERNST_REFERENCE_KELVIN));
+        if (segments.count == 1)
+        {
+            dfrobotPHFromVoltageBatchCompensated(segments.slope[0], segments.intercept[0], nernstTable, voltage, temperature, out, n);
+        }
+        else
+        {
+            dfrobotPHFromSegmentsBatch(&segments, voltage, out, n);
+            dfrobotPHNernstApplyBatch(nernstTable, temperature, out, n);
+        }
+    }
+}
+
 /**
  * @brief calibrates the pH sensor given a remote command
  * 
  * @param cmd calibration command
  */
-void DFRobotESPpH::calibration(char *cmd) {
-    strupr(cmd);
-
+void DFRobotESPpH::calibration(const char *cmd) {
     // if received Serial CMD from the serial monitor, enter into the calibration mode
-    phCalibration(cmdParse(cmd));
+    handleCommand(cmd);
 }
 
 
@@ -136,66 +1401,202 @@ void DFRobotESPpH::calibration(char *cmd) {
  * 
  */
 void DFRobotESPpH::calibration() {
+    serviceStorage();
     if (cmdSerialDataAvailable() > 0)
     {
-      if(strstr(this->_cmdReceivedBuffer, "MANCALPH") != NULL){
-        int v7 = 0, v4 = 0;
-        Serial.println("Manual Calibration: Please enter the voltage value for pH 4");
-        while(cmdSerialDataAvailable() <= 0){}
-        if(strstr(this->_cmdReceivedBuffer, "EXIT") != NULL){
-          return;
+        handleCommand(this->_cmdReceivedBuffer);
+    }
+}
+/**
+ * @brief Handles command lines pushed by the application, e.g. from an MQTT, BLE or WebSocket handler
+ *        The frame may hold several lines separated by '\n' and does not need a terminating NUL
+ * 
+ * @param frame received bytes
+ * @param length number of bytes
+ */
+void DFRobotESPpH::feedCommand(const char *frame, size_t length) {
+    serviceStorage();
+    while (length > 0)
+    {
+        const char *newline = (const char *)memchr(frame, '\n', length);
+        size_t lineLength = newline != NULL ? (size_t)(newline - frame) : length;
+        size_t copyLength = lineLength < ReceivedBufferLength - 1 ? lineLength : ReceivedBufferLength - 1;
+        // the line is terminated in the command buffer, a partial serial line in it is dropped
+        memcpy(this->_cmdReceivedBuffer, frame, copyLength);
+        this->_cmdReceivedBuffer[copyLength] = '\0';
+        this->_cmdReceivedBufferIndex = 0;
+        if (copyLength > 0)
+        {
+            handleCommand(this->_cmdReceivedBuffer);
+        }
+        if (newline == NULL)
+        {
+            break;
         }
-        else{
-          v7 = atoi(_cmdReceivedBuffer);
+        frame = newline + 1;
+        length -= lineLength + 1;
+    }
+}
+
+/**
+ * @brief Selects where commands are read from and where calibration messages are written to
+ * 
+ * @param stream command source and reply destination, NULL to only take commands through feedCommand()/calibration(cmd)
+ */
+void DFRobotESPpH::setCommandStream(Stream *stream) {
+    this->_cmdStream = stream;
+    if (stream != NULL)
+    {
+        this->_console = stream;
+    }
+    this->_cmdReceivedBufferIndex = 0;
+    this->_cmdDiscarding = false;
+}
+
+/**
+ * @brief Selects where calibration messages are written to
+ * 
+ * @param output reply destination
+ */
+void DFRobotESPpH::setOutput(Print &output) {
+    this->_console = &output;
+}
+
+/**
+ * @brief manual calibration function, polls the command stream and advances the MANCALPH dialogue
+ *        Same as calibration(), kept for sketches written against the blocking version
+ * 
+ */
+void DFRobotESPpH::manualCalibration() {
+    calibration();
+}
+
+/**
+ * @brief Routes one command line to the MANCALPH dialogue or to the buffer calibration
+ * 
+ * @param line received command line
+ */
+void DFRobotESPpH::handleCommand(const char *line) {
+    const char *args;
+    byte command = cmdParse(line, &args);
+#ifdef DFROBOT_ESP_PH_PROFILE
+    if (command == PH_CMD_PHPROF)
+    {
+        if (strncasecmp(args, "RESET", 5) == 0)
+        {
+            dfrobotPHProfileReset();
         }
-        Serial.println("Manual Calibration: Please enter the voltage value for pH 7");
-        while(cmdSerialDataAvailable() <= 0){}
-        if(strstr(this->_cmdReceivedBuffer, "EXIT") != NULL){
-          return;
+        else
+        {
+            dfrobotPHProfilePrint(*this->_console);
         }
-        else{
-          v4 = atoi(_cmdReceivedBuffer);
+        return;
+    }
+#endif
+    if (this->_manualState != PH_MANUAL_IDLE || command == PH_CMD_MANCALPH)
+    {
+        manualCalibrationStep(command, args); // MANCALPH dialogue, one answer per call
+    }
+    else
+    {
+        if (command == PH_CMD_CALPH)
+        {
+            float ph;
+            boolean given = cmdArguments(args, &ph, 1) == 1 && ph > 0;
+            PH_LOCK();
+            this->_captureTargetPH = given ? ph : 0;
+            PH_UNLOCK();
         }
-        manualCalibration(v7, v4);
-      }
-      else{
-          phCalibration(cmdParse()); // if received Serial CMD from the serial monitor, enter into the calibration mode
-      }
+        phCalibration(command);
     }
 }
+
 /**
- * @brief manual calibration function
+ * @brief Advances the MANCALPH dialogue with the command that was just received
+ *        Never waits for input, each answer is handled by a later call
  * 
+ * @param command command from cmdParse()
+ * @param args arguments from cmdParse()
  */
-void DFRobotESPpH::manualCalibration() {
-  
-  if(cmdSerialDataAvailable() > 0){
-    
-  }
+void DFRobotESPpH::manualCalibrationStep(byte command, const char *args) {
+    float values[2];
+    if (this->_manualState == PH_MANUAL_IDLE)
+    {
+        if (cmdArguments(args, values, 2) == 2)
+        {
+            manualCalibration(values[0], values[1]); // MANCALPH <voltage7> <voltage4> in one line
+            return;
+        }
+        this->_manualState = PH_MANUAL_WAIT_NEUTRAL;
+        this->_console->println(F("Manual Calibration: Please enter the voltage value for pH 7"));
+        return;
+    }
+    if (command == PH_CMD_EXIT || command == PH_CMD_EXITPH)
+    {
+        this->_manualState = PH_MANUAL_IDLE;
+        this->_console->println(F("Manual Calibration: Exit without saving"));
+        return;
+    }
+
+    if (command != PH_CMD_NONE || cmdArguments(args, values, 1) != 1 || !(values[0] > 0 && values[0] <= PH_CAL_MAX_VOLTAGE))
+    {
+        this->_console->println(F("Manual Calibration: Not a voltage, try again or send EXIT"));
+        return;
+    }
+
+    if (this->_manualState == PH_MANUAL_WAIT_NEUTRAL)
+    {
+        this->_manualNeutralVoltage = values[0];
+        this->_manualState = PH_MANUAL_WAIT_ACID;
+        this->_console->println(F("Manual Calibration: Please enter the voltage value for pH 4"));
+    }
+    else
+    {
+        this->_manualState = PH_MANUAL_IDLE;
+        manualCalibration(this->_manualNeutralVoltage, values[0]);
+    }
 }
 
 /**
- * @brief checks to see whether serial data is/is not available
+ * @brief checks to see whether a complete line is available on the command stream
  * 
  * @return boolean True if data is available, False otherwise
  */
 boolean DFRobotESPpH::cmdSerialDataAvailable()
 {
     char cmdReceivedChar;
-    static unsigned long cmdReceivedTimeOut = millis();
-    while (Serial.available() > 0)
+    if (this->_cmdStream == NULL)
+    {
+        return false;
+    }
+    while (this->_cmdStream->available() > 0)
     {
-        if (millis() - cmdReceivedTimeOut > 500U)
+        if (millis() - this->_cmdReceivedTimeOut > 500U)
         {
             this->_cmdReceivedBufferIndex = 0;
+            this->_cmdDiscarding = false; // a pause ends the line, like a '\n'
             memset(this->_cmdReceivedBuffer, 0, (ReceivedBufferLength));
         }
-        cmdReceivedTimeOut = millis();
-        cmdReceivedChar = Serial.read();
-        if (cmdReceivedChar == '\n' || this->_cmdReceivedBufferIndex == ReceivedBufferLength - 1)
+        this->_cmdReceivedTimeOut = millis();
+        cmdReceivedChar = this->_cmdStream->read();
+        if (this->_cmdDiscarding)
+        {
+            // tail of a line already delivered cut, it must not come back as a command of its own
+            this->_cmdDiscarding = cmdReceivedChar != '\n';
+            continue;
+        }
+        if (cmdReceivedChar == '\n')
+        {
+            this->_cmdReceivedBuffer[this->_cmdReceivedBufferIndex] = '\0';
+            this->_cmdReceivedBufferIndex = 0;
+            return true;
+        }
+        if (this->_cmdReceivedBufferIndex == ReceivedBufferLength - 1)
         {
+            // too long: deliver the first ReceivedBufferLength - 1 characters, like feedCommand(), and skip the rest
+            this->_cmdReceivedBuffer[this->_cmdReceivedBufferIndex] = '\0';
             this->_cmdReceivedBufferIndex = 0;
-            strupr(this->_cmdReceivedBuffer);
+            this->_cmdDiscarding = true;
             return true;
         }
         else
@@ -207,49 +1608,94 @@ boolean DFRobotESPpH::cmdSerialDataAvailable()
     return false;
 }
 
+// command words, matched case-insensitively against the first token of a line
+static const struct {
+    const char *name;
+    byte length;
+    byte command;
+} commandTable[] = {
+    {"ENTERPH", 7, PH_CMD_ENTERPH},
+    {"CALPH", 5, PH_CMD_CALPH},
+    {"EXITPH", 6, PH_CMD_EXITPH},
+    {"MANCALPH", 8, PH_CMD_MANCALPH},
+    {"EXIT", 4, PH_CMD_EXIT},
+    {"CLEARPH", 7, PH_CMD_CLEARPH},
+#ifdef DFROBOT_ESP_PH_PROFILE
+    {"PHPROF", 6, PH_CMD_PHPROF},
+#endif
+};
+
 /**
  * @brief parses a remote command
+ *        One pass over the line: the first word is looked up in commandTable, the rest is left
+ *        in place as arguments. Nothing is copied or modified.
  * 
  * @param cmd input command
- * @return byte index mode
+ * @param args set to the first argument after the command word, or to the first word if it is not a command
+ * @return byte PH_CMD_* index mode
  */
-byte DFRobotESPpH::cmdParse(const char *cmd) {
-    byte modeIndex = 0;
-    if (strstr(cmd, "ENTERPH") != NULL)
+byte DFRobotESPpH::cmdParse(const char *cmd, const char **args) {
+    while (*cmd == ' ' || *cmd == '\t')
+    {
+        cmd++;
+    }
+    const char *end = cmd;
+    while (*end != '\0' && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n')
     {
-        modeIndex = 1;
+        end++;
     }
-    else if (strstr(cmd, "EXITPH") != NULL)
+    size_t length = end - cmd;
+
+    byte command = PH_CMD_NONE;
+    for (size_t i = 0; i < sizeof(commandTable) / sizeof(commandTable[0]); i++)
     {
-        modeIndex = 3;
+        if (commandTable[i].length == length && strncasecmp(cmd, commandTable[i].name, length) == 0)
+        {
+            command = commandTable[i].command;
+            break;
+        }
     }
-    else if (strstr(cmd, "CALPH") != NULL)
+
+    if (args != NULL)
     {
-        modeIndex = 2;
+        if (command == PH_CMD_NONE)
+        {
+            *args = cmd;
+        }
+        else
+        {
+            while (*end == ' ' || *end == '\t')
+            {
+                end++;
+            }
+            *args = end;
+        }
     }
-    return modeIndex;
+    return command;
 }
 
 /**
- * @brief recieves a command and parses it
+ * @brief Reads numeric arguments of a command in place
  * 
- * @return byte index mode
+ * @param args arguments from cmdParse()
+ * @param values receives the numbers
+ * @param maxValues size of values
+ * @return byte number of values read, parsing stops at the first word that is not a number
  */
-byte DFRobotESPpH::cmdParse() {
-    byte modeIndex = 0;
-    if (strstr(this->_cmdReceivedBuffer, "ENTERPH") != NULL)
-    {
-        modeIndex = 1;
-    }
-    else if (strstr(this->_cmdReceivedBuffer, "EXITPH") != NULL)
-    {
-        modeIndex = 3;
-    }
-    else if (strstr(this->_cmdReceivedBuffer, "CALPH") != NULL)
+byte DFRobotESPpH::cmdArguments(const char *args, float *values, byte maxValues) {
+    byte count = 0;
+    while (count < maxValues)
     {
-        modeIndex = 2;
+        char *end;
+        float value = strtod(args, &end);
+        if (end == args)
+        {
+            break;
+        }
+        values[count++] = value;
+        args = end;
     }
-    return modeIndex;
+    return count;
 }
 
 /**
@@ -258,106 +1704,290 @@ byte DFRobotESPpH::cmdParse() {
  * @param mode the mode from cmdparse
  */
 void DFRobotESPpH::phCalibration(byte mode) {
-    char *receivedBufferPtr;
-    static boolean phCalibrationFinish = 0;
-    static boolean enterCalibrationFlag = 0;
     switch (mode)
     {
-    case 0:
-        if (enterCalibrationFlag)
+    case PH_CMD_NONE:
+        if (this->_enterCalibrationFlag)
         {
-            Serial.println(F(">>>Command Error<<<"));
+            this->_console->println(F(">>>Command Error<<<"));
         }
         break;
 
-    case 1:
-        enterCalibrationFlag = 1;
-        phCalibrationFinish = 0;
-        Serial.println();
-        Serial.println(F(">>>Enter PH Calibration Mode<<<"));
-        Serial.println(F(">>>Please put the probe into the 4.0 or 7.0 standard buffer solution<<<"));
-        Serial.println();
+    case PH_CMD_ENTERPH:
+        this->_enterCalibrationFlag = 1;
+        this->_phCalibrationFinish = 0;
+        this->_captureDeadlineMs = 0; // an automatic capture waits as long as it takes
+        this->_trendRestart = true;
+        this->_capturePending = this->_autoCapture;
+        PH_LOCK();
+        this->_sessionResponseMs = 0;
+        this->_settleStartMs = 0;
+        this->_settleMs = 0;
+        PH_UNLOCK();
+        this->_console->println();
+        this->_console->println(F(">>>Enter PH Calibration Mode<<<"));
+        this->_console->println(F(">>>Please put the probe into the 4.0, 7.0 or 10.0 standard buffer solution<<<"));
+        this->_console->println();
         break;
 
-    case 2:
-        if (enterCalibrationFlag)
-        {
-            if ((this->_voltage > PH_8_VOLTAGE) && (this->_voltage < PH_6_VOLTAGE))
-            { // buffer solution:7.0
-                Serial.println();
-                Serial.print(F(">>>Buffer Solution:7.0"));
-                this->_neutralVoltage = this->_voltage;
-                Serial.println(F(",Send EXITPH to Save and Exit<<<"));
-                Serial.println();
-                phCalibrationFinish = 1;
-            }
-            else if ((this->_voltage > PH_5_VOLTAGE) && (this->_voltage < PH_3_VOLTAGE))
-            { //buffer solution:4.0
-                Serial.println();
-                Serial.print(F(">>>Buffer Solution:4.0"));
-                this->_acidVoltage = this->_voltage;
-                Serial.println(F(",Send EXITPH to Save and Exit<<<"));
-                Serial.println();
-                phCalibrationFinish = 1;
+    case PH_CMD_CALPH:
+        if (this->_enterCalibrationFlag)
+        {
+            // the capture itself always runs in getPH(), the only writer of the buffer voltages while calibrating
+            if (this->_capturePending && this->_captureDeadlineMs != 0)
+            {
+                this->_captureDeadlineMs = millis() | 1; // CALPH again while waiting: capture on the next getPH()
             }
             else
             {
-                Serial.println();
-                Serial.print(F(">>>Buffer Solution Error Try Again<<<"));
-                Serial.println(); // not buffer solution or faulty operation
-                phCalibrationFinish = 0;
+                this->_captureDeadlineMs = (millis() + PH_CAPTURE_TIMEOUT_MS) | 1; // never 0, 0 means no timeout
+                this->_capturePending = true;
+                if (!isStable())
+                {
+                    this->_console->println();
+                    this->_console->println(F(">>>Waiting for a stable reading, send CALPH again to capture now<<<"));
+                    this->_console->println();
+                }
             }
         }
         break;
 
-    case 3://store calibration value in eeprom
-        if (enterCalibrationFlag)
+    case PH_CMD_CLEARPH:
+        if (this->_enterCalibrationFlag)
+        {
+            clearCalibrationPoints();
+            this->_console->println();
+            this->_console->println(F(">>>Cleared buffers beyond 4.0 and 7.0<<<"));
+            this->_console->println();
+        }
+        break;
+
+    case PH_CMD_EXITPH://store calibration value in eeprom
+        if (this->_enterCalibrationFlag)
         {
-            Serial.println();
-			preferences.begin("pHVals", false);
-            if (phCalibrationFinish)
+            this->_console->println();
+            if (this->_phCalibrationFinish)
             {
-                if ((this->_voltage > PH_8_VOLTAGE) && (this->_voltage < PH_5_VOLTAGE))
-                {
-                    preferences.putFloat("voltage7", this->_neutralVoltage);
-					Serial.print(F("PH 7 Calibration value SAVE THIS FOR LATER: "));
-					Serial.print(this->_neutralVoltage);
-                }
-                else if ((this->_voltage > PH_5_VOLTAGE) && (this->_voltage < PH_3_VOLTAGE))
-                {
-                    preferences.putFloat("voltage4", this->_acidVoltage);
-					Serial.print(F("PH 4 Calibration value SAVE THIS FOR LATER: "));
-					Serial.print(this->_acidVoltage);
-                }
-                Serial.print(F(">>>Calibration Successful"));
+                PH_LOCK();
+                this->_pendingWrite = true;
+                float capturedPH = this->_capturedPH;
+                float capturedVoltage = this->_capturedVoltage;
+                PH_UNLOCK();
+                this->_console->print(F("PH "));
+                this->_console->print(capturedPH, 2);
+                this->_console->print(F(" Calibration value SAVE THIS FOR LATER: "));
+                this->_console->println(capturedVoltage);
+                DFRobotESPpHDiagnostics diagnostics = getDiagnostics();
+                this->_console->print(F("Slope "));
+                this->_console->print(diagnostics.nernstPercent, 1);
+                this->_console->print(F("% Offset "));
+                this->_console->print(diagnostics.offset, 1);
+                this->_console->print(F(" mV Response "));
+                this->_console->print(diagnostics.responseMs / 1000.0, 1);
+                this->_console->println(F(" s"));
+                this->_console->print(F(">>>Calibration Successful"));
             }
             else
             {
-                Serial.print(F(">>>Calibration Failed"));
+                this->_console->print(F(">>>Calibration Failed"));
             }
-			preferences.end();
-            Serial.println(F(",Exit PH Calibration Mode<<<"));
-            Serial.println();
-            phCalibrationFinish = 0;
-            enterCalibrationFlag = 0;
+            flushCalibration(true); // explicit save, never left to the throttle
+            this->_console->println(F(",Exit PH Calibration Mode<<<"));
+            this->_console->println();
+            this->_phCalibrationFinish = 0;
+            this->_enterCalibrationFlag = 0;
+            this->_capturePending = false;
         }
         break;
     }
 }
 
+// buffers recognized by CALPH unless setBufferWindows() is called
+static const DFRobotESPpHBufferWindow defaultWindows[] = {
+    {7.0, PH_8_VOLTAGE, PH_6_VOLTAGE},
+    {4.0, PH_5_VOLTAGE, PH_3_VOLTAGE},
+    {10.0, PH_11_VOLTAGE, PH_9_VOLTAGE},
+};
+
+/**
+ * @brief Replaces the buffer recognition windows
+ * 
+ * @param windows table of buffers, NULL for the defaults
+ * @param count number of entries
+ */
+void DFRobotESPpH::setBufferWindows(const DFRobotESPpHBufferWindow *windows, byte count) {
+    if (windows == NULL)
+    {
+        windows = defaultWindows;
+        count = sizeof(defaultWindows) / sizeof(defaultWindows[0]);
+    }
+    this->_windows = windows;
+    this->_windowCount = count;
+}
+
+/**
+ * @brief Takes the settled voltage as the voltage of the buffer solution in use
+ *        Uses the mean of the stability window rather than a single sample
+ * 
+ */
+void DFRobotESPpH::captureCalibrationPoint() {
+    // automatic mode stays armed for the next buffer, or for another try after an error
+    this->_autoArmed = false;
+    this->_captureDeadlineMs = 0;
+    this->_capturePending = this->_autoCapture && this->_enterCalibrationFlag;
+    PH_LOCK();
+    float voltage = this->_trend.full() ? this->_trend.mean() : this->_voltage;
+    float ph = this->_captureTargetPH;
+    for (byte i = 0; ph <= 0 && i < this->_windowCount; i++)
+    {
+        if ((voltage > this->_windows[i].lowVoltage) && (voltage < this->_windows[i].highVoltage))
+        {
+            ph = this->_windows[i].ph;
+        }
+    }
+    boolean stored = ph > 0 && setCalibrationPoint(ph, voltage);
+    if (stored)
+    {
+        this->_capturedPH = ph;
+        this->_capturedVoltage = voltage;
+        if (this->_settleMs > this->_sessionResponseMs)
+        {
+            this->_sessionResponseMs = this->_settleMs;
+        }
+        this->_settleMs = 0; // the next buffer times its own settling
+        this->_responseMs = this->_sessionResponseMs;
+    }
+    PH_UNLOCK();
+
+    if (stored)
+    {
+        updateCoefficients();
+        this->_console->println();
+        this->_console->print(F(">>>Buffer Solution:"));
+        this->_console->print(ph, 2);
+        this->_console->println(F(",Send EXITPH to Save and Exit<<<"));
+        this->_console->println();
+        this->_phCalibrationFinish = 1;
+    }
+    else
+    {
+        this->_console->println();
+        this->_console->print(F(">>>Buffer Solution Error Try Again<<<"));
+        this->_console->println(); // not buffer solution or faulty operation
+        this->_phCalibrationFinish = 0;
+    }
+}
+
+/**
+ * @brief Stores the voltage of one buffer solution, the caller holds _lock
+ * 
+ * @param ph pH of the buffer
+ * @param voltage voltage measured in the buffer
+ * @return boolean false if there is no free point left
+ */
+boolean DFRobotESPpH::setCalibrationPoint(float ph, float voltage) {
+    if (ph > 7.0 - PH_BUFFER_MATCH && ph < 7.0 + PH_BUFFER_MATCH)
+    {
+        this->_neutralVoltage = voltage;
+        markCalibrated();
+        return true;
+    }
+    if (ph > 4.0 - PH_BUFFER_MATCH && ph < 4.0 + PH_BUFFER_MATCH)
+    {
+        this->_acidVoltage = voltage;
+        markCalibrated();
+        return true;
+    }
+    for (byte i = 0; i < this->_extraCount; i++)
+    {
+        if (this->_extraPH[i] > ph - PH_BUFFER_MATCH && this->_extraPH[i] < ph + PH_BUFFER_MATCH)
+        {
+            this->_extraVoltage[i] = voltage; // same buffer measured again
+            markCalibrated();
+            return true;
+        }
+    }
+    if (this->_extraCount >= PH_MAX_CAL_POINTS - 2)
+    {
+        return false;
+    }
+    this->_extraPH[this->_extraCount] = ph;
+    this->_extraVoltage[this->_extraCount] = voltage;
+    this->_extraCount++;
+    markCalibrated();
+    return true;
+}
+
+/**
+ * @brief Records the temperature and time of a calibration change for the blob and getDiagnostics()
+ * 
+ */
+void DFRobotESPpH::markCalibrated() {
+    this->_calTemperature = this->_temperature;
+    this->_calTimestamp = (uint32_t)time(NULL);
+}
+
+/**
+ * @brief Adds or replaces a buffer solution and saves the calibration
+ * 
+ * @param ph pH of the buffer
+ * @param voltage voltage measured in the buffer
+ * @return boolean false if all points are in use
+ */
+boolean DFRobotESPpH::addCalibrationPoint(float ph, float voltage) {
+    PH_LOCK();
+    boolean stored = setCalibrationPoint(ph, voltage);
+    PH_UNLOCK();
+    if (!stored)
+    {
+        return false;
+    }
+    updateCoefficients();
+    this->_pendingWrite = true;
+    flushCalibration(false);
+    return true;
+}
+
+/**
+ * @brief Drops every buffer beyond pH 4.0 and 7.0 and saves the calibration
+ * 
+ */
+void DFRobotESPpH::clearCalibrationPoints() {
+    PH_LOCK();
+    this->_extraCount = 0;
+    PH_UNLOCK();
+    updateCoefficients();
+    this->_pendingWrite = true;
+    flushCalibration(false);
+}
+
 /**
  * @brief Manually calibrate the pH sensor 
  * 
  * @param voltage7 voltage at pH 7
  * @param voltage4 voltage at pH 4
+ * @return boolean false if the voltages cannot be a calibration
  */
-void DFRobotESPpH::manualCalibration(float voltage7, float voltage4){
-	preferences.begin("pHVals", false);
-	
-	preferences.putFloat("voltage7", this->_neutralVoltage);
-	Serial.println(F("PH 7 Calibration value saved"));
-	preferences.putFloat("voltage4", this->_acidVoltage);
-	Serial.println(F("PH 4 Calibration value saved"));
-	
-	preferences.end();
+boolean DFRobotESPpH::manualCalibration(float voltage7, float voltage4){
+    float span = voltage7 - voltage4;
+    // written as accepted ranges so NAN is rejected as well
+    if (!(voltage7 > 0 && voltage7 <= PH_CAL_MAX_VOLTAGE && voltage4 > 0 && voltage4 <= PH_CAL_MAX_VOLTAGE)
+        || !(span >= PH_CAL_MIN_SPAN || span <= -PH_CAL_MIN_SPAN))
+    {
+        this->_console->println(F("Manual Calibration: Voltages out of range or too close, nothing saved"));
+        return false;
+    }
+    PH_LOCK();
+    this->_neutralVoltage = voltage7;
+    this->_acidVoltage = voltage4;
+    markCalibrated();
+    this->_responseMs = 0; // typed in, nothing was timed
+    PH_UNLOCK();
+    updateCoefficients();
+
+    this->_pendingWrite = true;
+    flushCalibration(true); // the messages below claim it is stored
+	this->_console->println(F("PH 7 Calibration value saved"));
+	this->_console->println(F("PH 4 Calibration value saved"));
+    return true;
 }
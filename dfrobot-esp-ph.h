@@ -23,8 +23,25 @@
 
 #include "Arduino.h"
 #include <Preferences.h>
+#include <atomic>
+#ifdef ARDUINO_ARCH_ESP32
+#include "freertos/FreeRTOS.h"
+#endif
+#include "dfrobot-esp-ph-kernel.h"
+#include "dfrobot-esp-ph-history.h"
+
+#ifndef ReceivedBufferLength
+#define ReceivedBufferLength 32 //length of the Serial CMD buffer, longer lines are cut
+#endif
+
+// Define DFROBOT_ESP_PH_DEBUG (here or in the build flags) to compile in the getPH() voltage trace.
+// When it is not defined the trace is removed entirely and setDebug() does nothing.
+//#define DFROBOT_ESP_PH_DEBUG
 
-#define ReceivedBufferLength 10 //length of the Serial CMD buffer
+// Define DFROBOT_ESP_PH_PROFILE to time each sampling and storage stage, see dfrobot-esp-ph-profile.h.
+// The PHPROF command prints the counters and PHPROF RESET clears them. Nothing is compiled in without it.
+//#define DFROBOT_ESP_PH_PROFILE
+#include "dfrobot-esp-ph-profile.h"
 
 
 //#define PHVALUEADDR 0x00 //the start address of the pH calibration parameters stored in the EEPROM
@@ -32,32 +49,362 @@
 #define PH_6_VOLTAGE 1478
 #define PH_5_VOLTAGE 1654
 #define PH_3_VOLTAGE 2010
+#define PH_11_VOLTAGE 688  //pH 10.0 buffer window, same spacing around pH 10 as the 4.0 window around pH 4
+#define PH_9_VOLTAGE 1018
+#define PH_DEFAULT_NEUTRAL_VOLTAGE 1348.68 //typical pH 7.0 voltage at 25C, used until calibrated
+#define PH_DEFAULT_ACID_VOLTAGE 1844.17    //typical pH 4.0 voltage at 25C, used until calibrated
+#define PH_BUFFER_MATCH 0.05 //a CALPH <pH> this close to 4.0 or 7.0 replaces that point
+#ifndef PH_CAL_MAX_VOLTAGE
+#define PH_CAL_MAX_VOLTAGE 3300.0 //highest buffer voltage manualCalibration() accepts, the ADC full scale
+#endif
+#define PH_CAL_MIN_SPAN 100.0 //mV manualCalibration() wants between pH 7.0 and 4.0, a good probe gives about 500
+
+// The continuous (DMA) ADC driver is exposed by arduino-esp32 3.x through analogContinuous()
+#if defined(ARDUINO_ARCH_ESP32) && defined(ESP_ARDUINO_VERSION_MAJOR)
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+#define DFROBOT_ESP_PH_HAS_STREAMING
+#endif
+#endif
+
+// Raw count to millivolt lookup table built from the chip's eFuse ADC calibration (esp_adc_cal).
+// Costs PH_ADC_LUT_SIZE * 2 bytes of RAM shared by all instances. Define DFROBOT_ESP_PH_NO_ADC_LUT to leave it out.
+#if defined(ARDUINO_ARCH_ESP32) && !defined(DFROBOT_ESP_PH_NO_ADC_LUT) && !defined(CONFIG_IDF_TARGET_ESP32S2)
+#if defined(__has_include)
+#if __has_include("esp_adc_cal.h")
+#define DFROBOT_ESP_PH_HAS_ADC_LUT
+#endif
+#endif
+#endif
+#define PH_ADC_LUT_SIZE 4096 //one entry per 12-bit ADC count
+
+// Deep sleep sampling by the ULP coprocessor, original ESP32 only (the S2/S3 ULP has a different instruction set).
+// Needs the ULP enabled in the core's sdkconfig, which arduino-esp32 does by default.
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_IDF_TARGET_ESP32) && defined(CONFIG_ULP_COPROC_ENABLED) && defined(__has_include)
+#if __has_include("esp32/ulp.h")
+#define DFROBOT_ESP_PH_HAS_ULP
+#endif
+#endif
+#define PH_ULP_DATA_WORD 0    //RTC_SLOW_MEM word the ULP stores the last ADC count in
+#define PH_ULP_PROGRAM_WORD 1 //RTC_SLOW_MEM word the ULP program is loaded at
+#define PH_ULP_SAMPLES_SHIFT 2 //the ULP averages 1 << PH_ULP_SAMPLES_SHIFT conversions per wake-up
+
+#define PH_NVS_NAMESPACE "pHVals"        //Preferences namespace holding the calibration
+#define PH_NVS_DEFAULT_KEY "phcal"       //blob key used by begin() when no key is given
+#define PH_NVS_KEY_LENGTH 16            //NVS keys are at most 15 characters
+#define PH_NVS_COMMIT_INTERVAL_MS 2000U //minimum time between two calibration writes, later ones are coalesced
+
+#define PH_TEMPERATURE_THRESHOLD 0.1 //temperature change in C that triggers a new Nernst correction in readPH()
+
+//commands recognized by cmdParse()
+#define PH_CMD_NONE 0     //not a command, e.g. a value typed during MANCALPH
+#define PH_CMD_ENTERPH 1
+#define PH_CMD_CALPH 2
+#define PH_CMD_EXITPH 3
+#define PH_CMD_MANCALPH 4 //optionally followed by <voltage7> <voltage4>
+#define PH_CMD_EXIT 5
+#define PH_CMD_CLEARPH 6
+#define PH_CMD_PHPROF 7   //only recognized in DFROBOT_ESP_PH_PROFILE builds, optionally followed by RESET
+
+#ifndef PH_COMMAND_QUEUE_LENGTH
+#define PH_COMMAND_QUEUE_LENGTH 8 //lines postCommand() holds for processCommands(), shared by all instances
+#endif
+
+//steps of the MANCALPH dialogue
+#define PH_MANUAL_IDLE 0         //not in manual calibration
+#define PH_MANUAL_WAIT_NEUTRAL 1 //waiting for the pH 7 voltage
+#define PH_MANUAL_WAIT_ACID 2    //waiting for the pH 4 voltage
+
+#ifndef PH_HISTORY_LENGTH
+#define PH_HISTORY_LENGTH 32 //pH samples kept for the rolling statistics
+#endif
+
+#define PH_STABILITY_WINDOW 16      //trend points the stability slope is fitted over
+#ifndef PH_STABILITY_INTERVAL_MS
+#define PH_STABILITY_INTERVAL_MS 250 //minimum time per trend point, getPH() calls within it are averaged (window of 4 s)
+#endif
+#ifndef PH_CAPTURE_TIMEOUT_MS
+#define PH_CAPTURE_TIMEOUT_MS 60000U //CALPH captures even an unstable reading after waiting this long
+#endif
+#define PH_STABLE_SLOPE_MV_PER_S 1.0 //default drift below which a reading counts as stable (about 0.006 pH/s)
 
+//alarm bits, see setHighAlarm()/setLowAlarm()/setRateAlarm() and getAlarmState()
+#define PH_ALARM_HIGH 0x01 //pH above the high limit
+#define PH_ALARM_LOW 0x02  //pH below the low limit
+#define PH_ALARM_RATE 0x04 //pH changing faster than the rate limit
+//events passed to the alarm callback
+#define PH_EVENT_HIGH 1
+#define PH_EVENT_HIGH_CLEARED 2
+#define PH_EVENT_LOW 3
+#define PH_EVENT_LOW_CLEARED 4
+#define PH_EVENT_RATE 5
+#define PH_EVENT_RATE_CLEARED 6
 
+//probe diagnostics, see getDiagnostics()
+#define PH_BOARD_MIDPOINT_VOLTAGE 1500 //board output in mV for 0 mV at the probe
+#define PH_BOARD_GAIN 3.0              //board output mV per probe mV
+#define PH_NERNST_SLOPE_MV 59.16       //ideal probe mV per pH at 25C
+#define PH_PROBE_GOOD 0    //slope and offset within the good limits
+#define PH_PROBE_WORN 1    //still usable, clean the probe and recalibrate
+#define PH_PROBE_REPLACE 2 //outside the worn limits
+#ifndef PH_HEALTH_SLOPE_GOOD_MIN
+#define PH_HEALTH_SLOPE_GOOD_MIN 95.0  //% of Nernstian
+#define PH_HEALTH_SLOPE_GOOD_MAX 105.0
+#define PH_HEALTH_SLOPE_WORN_MIN 85.0
+#define PH_HEALTH_SLOPE_WORN_MAX 110.0
+#define PH_HEALTH_OFFSET_GOOD 30.0     //probe mV at pH 7.0, either sign
+#define PH_HEALTH_OFFSET_WORN 60.0
+#endif
+
+//adaptive task period, see setAdaptivePeriod()
+#define PH_ADAPT_FASTER 0.5 //period factor when the signal moves faster than the thresholds
+#define PH_ADAPT_SLOWER 1.25 //period factor when it stays below half of them
+#define PH_TASK_STACK_SIZE 4096 //stack of the background sampling task, alarm callbacks run on it
+#ifndef PH_LATEST_SPIN_RETRIES
+#define PH_LATEST_SPIN_RETRIES 4 //torn copies latest() retries at once before yielding a tick per retry
+#endif
+
+#define PH_MAX_OVERSAMPLING 32 //upper bound of ADC samples taken per getPH() call (stack buffer size)
+
+//filters applied to the oversampled ADC readings, see setOversampling()
+#define PH_OVERSAMPLE_MEAN 0         //plain average of all samples
+#define PH_OVERSAMPLE_MEDIAN 1       //middle sample, rejects single spikes
+#define PH_OVERSAMPLE_TRIMMED_MEAN 2 //average of the samples left after dropping the lowest and highest quarter
+
+//recursive filters applied to the voltage of every getPH() call, see setSmoothing()
+#define PH_SMOOTH_NONE 0   //voltage goes to readPH() as sampled
+#define PH_SMOOTH_EMA 1    //exponential moving average
+#define PH_SMOOTH_KALMAN 2 //1-D Kalman filter with constant process and measurement noise
+#define PH_SMOOTH_DEFAULT_ALPHA 0.2            //EMA weight of the new sample
+#define PH_SMOOTH_DEFAULT_PROCESS_NOISE 0.05   //Kalman drift variance per sample, mV^2
+#define PH_SMOOTH_DEFAULT_MEASUREMENT_NOISE 4.0 //Kalman ADC noise variance, mV^2
+
+
+
+
+/**
+ * @brief One published sample, see DFRobotESPpH::latest()
+ */
+typedef struct {
+    float raw;          // ADC count after oversampling, before the mV scaling
+    float voltage;      // mV
+    float ph;
+    float temperature;  // C used for compensation
+    uint32_t timestamp; // millis() when sampled
+    uint32_t count;     // samples published so far, tells consumers whether a new one arrived
+    float mean;         // pH rolling statistics over the last PH_HISTORY_LENGTH samples
+    float min;
+    float max;
+    float stddev;
+} DFRobotESPpHReading;
+
+/**
+ * @brief Probe quality derived from the calibration, see DFRobotESPpH::getDiagnostics()
+ */
+typedef struct {
+    float nernstPercent; // probe slope over the pH 4.0/7.0 span in % of the Nernstian slope at temperature
+    float offset;        // probe mV in the pH 7.0 buffer (neutral voltage from the board midpoint), ideally 0
+    uint32_t responseMs; // settling time of the slowest buffer of the last calibration, 0 if it was not measured
+    float temperature;   // C while calibrating
+    uint32_t timestamp;  // seconds since 1970 when calibrated, 0 for the defaults or a migrated per-key calibration
+    byte health;         // PH_PROBE_*
+} DFRobotESPpHDiagnostics;
 
+/**
+ * @brief Gets the shared raw count to millivolt table built from the eFuse ADC calibration
+ *        The table is filled on the first call and has PH_ADC_LUT_SIZE + 1 entries
+ * 
+ * @return const uint16_t* NULL if the chip or build has no eFuse ADC calibration
+ */
+const uint16_t *dfrobotPHAdcMillivoltTable();
+
+/**
+ * @brief Gets the Preferences handle on PH_NVS_NAMESPACE shared by the whole library
+ *        Opened read-write on the first call and kept open, so calibration loads and saves
+ *        of any number of probes do not pay for an NVS open/close each
+ * 
+ * @return Preferences& 
+ */
+Preferences &dfrobotPHPreferences();
+
+/**
+ * @brief Reads a calibration blob and checks its size, version and crc
+ *        Version 1 and 2 records are accepted, the fields they do not have are left 0
+ * 
+ * @param key NVS key of the blob
+ * @param blob Receives the record, all 0 when the result is 0
+ * @return byte Layout version of the stored record, 0 if there is none or it is corrupt
+ */
+byte dfrobotPHLoadCalibration(const char *key, DFRobotESPpHCalibrationBlob *blob);
+
+/**
+ * @brief Writes a calibration blob in the current layout
+ *        version, size and crc are filled in, the other fields are written as given
+ * 
+ * @param key NVS key of the blob
+ * @param blob Record to store
+ * @return boolean false if the write failed
+ */
+boolean dfrobotPHStoreCalibration(const char *key, DFRobotESPpHCalibrationBlob *blob);
+
+/**
+ * @brief Voltage range in which CALPH recognizes a buffer solution, see DFRobotESPpH::setBufferWindows()
+ */
+typedef struct {
+    float ph;
+    float lowVoltage;  // mV, exclusive
+    float highVoltage; // mV, exclusive
+} DFRobotESPpHBufferWindow;
+
+class DFRobotESPpH;
+class DFRobotESPpHLogger;
+
+/**
+ * @brief Called by getPH() when an alarm is raised or cleared
+ * 
+ * @param probe Instance that sampled
+ * @param event PH_EVENT_*
+ * @param ph pH of the sample, or pH per minute for the rate events
+ * @param context Pointer given to setAlarmCallback()
+ */
+typedef void (*DFRobotESPpHAlarmCallback)(DFRobotESPpH &probe, byte event, float ph, void *context);
 
 class DFRobotESPpH {
+    friend class DFRobotESPpHReader; // copies the calibration out
 private:
-    Preferences preferences;
     float _phValue;
+    float _raw; // ADC count of the last getPH()
     float _acidVoltage;
     float _neutralVoltage;
     float _voltage;
     float _temperature;
+    float _slope;     // pH per mV, derived from _neutralVoltage/_acidVoltage
+    float _intercept; // pH at 0 mV, derived from _neutralVoltage/_acidVoltage
+    byte _extraCount; // buffers calibrated beyond pH 4.0 and 7.0
+    float _extraVoltage[PH_MAX_CAL_POINTS - 2];
+    float _extraPH[PH_MAX_CAL_POINTS - 2];
+    DFRobotESPpHSegments _segments; // piecewise fit through all buffers at _calTemperature
+    float _compTemperature; // temperature the compensated fits below were computed for
+    float _compSlope;       // _slope with the Nernst correction for _compTemperature applied
+    float _compIntercept;   // _intercept with the Nernst correction for _compTemperature applied
+    DFRobotESPpHSegments _compSegments; // _segments with the Nernst correction applied
+    DFRobotESPpHFixed _fixed; // integer fit from ADC count to pH, derived from the compensated fit and the ADC scaling
     
     // added below
-    float ESPADC;
-    int ESPVOLTAGE;
     int PH_PIN;
+    float _mvPerCount;     // ESPVOLTAGE / ESPADC given to init(), linear scaling used when the lookup table is not available
+    const uint16_t *_adcTable; // eFuse calibrated count to mV table, NULL for linear scaling
+    byte _oversampleCount; // ADC samples per getPH() call
+    byte _oversampleMode;  // PH_OVERSAMPLE_* filter
+    boolean _streaming;    // PH_PIN is owned by the continuous ADC driver
+    float _streamRaw;      // average of the most recent DMA block
+    byte _smoothMode;      // PH_SMOOTH_* filter
+    boolean _smoothPrimed; // _smoothVoltage holds an estimate
+    float _smoothVoltage;  // filtered voltage, mV
+    float _smoothVariance; // Kalman estimate variance, mV^2
+    float _smoothAlpha;
+    float _smoothProcessNoise;
+    float _smoothMeasurementNoise;
+#ifdef DFROBOT_ESP_PH_DEBUG
+    boolean _debug; // runtime switch for the trace, only present in debug builds
+#endif
+
+
+    char _nvsKey[PH_NVS_KEY_LENGTH]; // blob key of this probe's calibration
+    boolean _pendingWrite;           // calibration changed since the last commit
+    unsigned long _lastCommitMs;  // millis() of the last calibration write
 
+    DFRobotESPpHHistory<PH_HISTORY_LENGTH> _history; // pH values of the last getPH() calls
+    DFRobotESPpHTrend<PH_STABILITY_WINDOW> _trend;   // voltage per PH_STABILITY_INTERVAL_MS or per call if slower, for the stability check
+    unsigned long _lastSampleMs; // millis() of the last trend point
+    float _bucketSum;            // voltages of the getPH() calls since the last trend point
+    uint16_t _bucketCount;
+    volatile unsigned long _captureDeadlineMs; // millis() at which a pending CALPH captures anyway, 0 for none
+    float _stableSlope;          // mV/s below which the reading is stable
+    boolean _autoCapture;        // capture the buffer voltage as soon as it is stable, without CALPH
+    std::atomic<bool> _capturePending; // a capture waits for the reading to settle, set by commands, cleared by getPH()
+    std::atomic<bool> _trendRestart;   // set by ENTERPH, getPH() drops the trend and bucket before its next point
+    boolean _autoArmed;                // the window moved since the last automatic capture, written by getPH() only
+    boolean _enterCalibrationFlag; // in ENTERPH calibration mode
+    std::atomic<bool> _phCalibrationFinish; // a buffer voltage was captured since ENTERPH
+    float _captureTargetPH;        // pH given with CALPH <pH>, 0 to recognize the buffer from its voltage
+    float _capturedPH;             // buffer captured since ENTERPH, for the EXITPH report
+    float _capturedVoltage;
+    float _calTemperature;        // temperature of the last calibration change
+    uint32_t _calTimestamp;       // time(NULL) of the last calibration change, stored in the blob
+    uint32_t _responseMs;         // settling time reported by getDiagnostics()
+    uint32_t _sessionResponseMs;  // slowest buffer captured since ENTERPH
+    unsigned long _settleStartMs; // millis() the reading became unstable during calibration, 0 while stable
+    uint32_t _settleMs;           // duration of the last settling, 0 once used by a capture
+    const DFRobotESPpHBufferWindow *_windows; // buffers CALPH recognizes without a pH argument
+    byte _windowCount;
 
+    // alarms, a limit of NAN disables it
+    DFRobotESPpHAlarmCallback _alarmCallback;
+    void *_alarmContext;
+    float _alarmHigh;
+    float _alarmHighHysteresis;
+    float _alarmLow;
+    float _alarmLowHysteresis;
+    float _alarmRate;           // pH per minute, absolute
+    float _alarmRateHysteresis;
+    byte _alarmState;           // PH_ALARM_* bits currently raised
+    DFRobotESPpHLogger *_logger; // receives every published sample, NULL for none
+    void evaluateAlarms();      // raise or clear alarms for the sample just taken
+    void updateAlarm(byte bit, boolean raise, boolean clear, byte event, float value);
+
+    // latest sample, published by getPH() under a sequence lock
+    std::atomic<uint32_t> _readingSequence; // odd while a sample is being written
+    DFRobotESPpHReading _reading;
+
+    // background sampling task
+    std::atomic<float> _taskTemperature; // temperature the task passes to getPH()
+    std::atomic<bool> _taskRunning;      // cleared to ask the task to exit
+    void *volatile _taskHandle;          // TaskHandle_t of the task, NULL when not running
+    uint32_t _taskPeriodMs;
+    uint32_t _adaptMinMs;  // shortest adaptive period, 0 when the period is fixed
+    uint32_t _adaptMaxMs;  // longest adaptive period
+    float _adaptRate;      // pH per minute considered active
+    float _adaptStddev;    // pH spread over the history considered active
+    float _adaptLastPH;    // pH of the previous task sample
+    static void taskEntry(void *instance);
+    void adaptTaskPeriod(); // lengthen or shorten _taskPeriodMs after a sample
+    float getPHRate();      // pH per minute from the stability slope and the pH 4/7 fit
+
+    byte _manualState;           // PH_MANUAL_* step of the MANCALPH dialogue
+    float _manualNeutralVoltage; // pH 7 voltage entered during MANCALPH
+
+    Stream *_cmdStream;                //commands are polled from here, NULL when they are only pushed
+    Print *_console;                   //calibration messages go here
+    unsigned long _cmdReceivedTimeOut; //millis() of the last received character
     char _cmdReceivedBuffer[ReceivedBufferLength]; //store the Serial CMD
     byte _cmdReceivedBufferIndex;
+    boolean _cmdDiscarding;            //the line in progress was cut, skip it up to its '\n'
+    static void dropCommands(DFRobotESPpH *probe); // remove the queued lines of a probe that goes away
+
+#ifdef ARDUINO_ARCH_ESP32
+    // guards the fits, trend, history and calibration points, so the sampling path and processCommands()
+    // on another task never see them half written
+    portMUX_TYPE _lock;
+#endif
 
     boolean cmdSerialDataAvailable();
+    float readRaw(); // sample PH_PIN according to the oversampling settings, returns the filtered ADC count
+    float rawToMillivolts(float raw); // ADC count to mV, lookup table or linear scaling
+    float smoothVoltage(float voltage); // apply the PH_SMOOTH_* filter, O(1)
+    void publishReading(); // make the last voltage/pH/temperature visible to latest()
+    void updateCoefficients(); // recompute the cached fits after the calibration voltages or ADC scaling change
+    void updateTemperatureCompensation(float temperature); // recompute _compSlope/_compIntercept/_fixed, caller holds _lock
+    void serviceStorage(); // write pending calibration once PH_NVS_COMMIT_INTERVAL_MS has passed
+    void handleCommand(const char *line);
+    void captureCalibrationPoint(); // take the settled voltage as the voltage of the buffer in use
+    void trackResponse(); // time the reading from unstable back to stable while calibrating
+    DFRobotESPpHDiagnostics diagnose(); // getDiagnostics() without the lock, for callers that hold it
+    void markCalibrated(); // note the temperature and time of a calibration change
+    boolean setCalibrationPoint(float ph, float voltage); // store a buffer voltage, without recomputing the fits, caller holds _lock
+    void manualCalibrationStep(byte command, const char *args); // advance the MANCALPH dialogue with the received command
     void phCalibration(byte mode); // calibration process, wirte key parameters to EEPROM
-    byte cmdParse(const char *cmd);
-    byte cmdParse();
+    byte cmdParse(const char *cmd, const char **args);
+    byte cmdArguments(const char *args, float *values, byte maxValues);
   
 public:
     DFRobotESPpH();
@@ -66,46 +413,440 @@ public:
      * @brief Calibrate the calibration data
      *
      * @param cmd         : ENTERPH -> enter the PH calibration mode
-     *                      CALPH   -> calibrate with the standard buffer solution, two buffer solutions(4.0 and 7.0) will be automaticlly recognized
+     *                      CALPH   -> calibrate with the standard buffer solution, three buffer solutions(4.0, 7.0 and 10.0) will be automaticlly recognized
+     *                      CALPH <pH> -> calibrate with a buffer solution of any pH, e.g. CALPH 6.86
+     *                      CLEARPH -> forget the buffers beyond 4.0 and 7.0
      *                      EXITPH  -> save the calibrated parameters and exit from PH calibration mode
+     *                      MANCALPH <voltage7> <voltage4> -> store a manual calibration in one line
+     *                      Commands are case-insensitive and cmd is not modified
+     *                      CALPH only arms the capture, the next getPH() with a stable reading takes it
      */
-    void calibration(char *cmd); //calibration by Serial CMD
+    void calibration(const char *cmd); //calibration by Serial CMD
     /**
      * @brief Runs calibration sequence for pH sensor
-     *        If correct command is received, enters calibration mode
+     *        If correct command is received, enters calibration mode.
+     *        Also drives the MANCALPH dialogue, see manualCalibration(). Never blocks, call it every loop.
      */
     void calibration();
+    /**
+     * @brief Handles complete command lines pushed by the application instead of polled from a stream
+     *        Lets a network task (MQTT, BLE, WebSocket...) deliver a whole frame at once.
+     *        Several lines can be separated by '\n', no terminating NUL is needed.
+     * 
+     * @param frame Received bytes
+     * @param length Number of bytes
+     */
+    void feedCommand(const char *frame, size_t length);
+    /**
+     * @brief Selects the stream commands are polled from by calibration(), Serial by default
+     *        Replies go to the same stream
+     * 
+     * @param stream Any Stream (Serial, Serial1, a WiFiClient...), NULL to only use feedCommand()/calibration(cmd)
+     */
+    void setCommandStream(Stream *stream);
+    /**
+     * @brief Selects where calibration messages are printed, Serial by default
+     * 
+     * @param output Any Print
+     */
+    void setOutput(Print &output);
+    /**
+     * @brief Queues a command line for a probe, safe to call from any task or core
+     *        The line is copied (cut at ReceivedBufferLength - 1 characters) into a queue shared by all
+     *        instances and handled by the next processCommands() call, so the caller never waits for a
+     *        capture or an NVS write, only for a probe being destroyed. Without FreeRTOS the line is handled at once.
+     * 
+     * @param probe Instance the command is for
+     * @param line Command, as for calibration(cmd)
+     * @param waitMs Time to wait for room when the queue is full
+     * @return boolean false if the queue is full
+     */
+    static boolean postCommand(DFRobotESPpH &probe, const char *line, uint32_t waitMs = 0);
+    /**
+     * @brief Handles the lines queued by postCommand(), in order, each on the probe it was posted for
+     *        Call it from one task, e.g. loop() or a task of its own. It can run alongside the sampling
+     *        tasks: they only share short critical sections around the fits, never the NVS write.
+     *        Do not mix it with calibration()/feedCommand() for the same probe on another task.
+     *        A probe may be destroyed while it runs: the destructor waits for the line in hand and drops the rest.
+     * 
+     * @param waitMs Time to wait for the first line, 0 to return at once
+     * @return byte Lines handled, at most PH_COMMAND_QUEUE_LENGTH per call
+     */
+    static byte processCommands(uint32_t waitMs = 0);
     /**
      * @brief Runs manual calibration sequence for pH sensor
      *        If correct command is received, enters manual calibration mode.
-     *        MANCALPH -> enter the PH manual calibration mode
+     *        MANCALPH -> enter the PH manual calibration mode, then send the pH 7 and the pH 4 voltage
+     *        MANCALPH <voltage7> <voltage4> -> calibrate in one line
      *        EXIT -> Exit without saving
-     *        Calibration uses while loops to wait for incoming data, so it may cause other processes to misbehave.
+     *        Each call handles at most one received line and returns, so call it every loop.
      */
     void manualCalibration();
     /**
      * @brief Runs calibration sequence for pH sensor
      *        If correct command is received, enters calibration mode
      * 
+     *        Voltages outside (0, PH_CAL_MAX_VOLTAGE] or closer than PH_CAL_MIN_SPAN are rejected and nothing is stored
+     * 
      * @param voltage7 Voltage value of pH sensor when submerged in pH 7 buffer solution
      * @param voltage4 Voltage value of pH sensor when submerged in pH 4 buffer solution
+     * @return boolean false if the voltages were rejected
+     */
+    boolean manualCalibration(float voltage7, float voltage4); //manually input 2-point calibration values
+    /**
+     * @brief Adds or replaces the voltage of one buffer solution
+     *        pH 7.0 and 4.0 set the two base points; any other pH adds a point, up to PH_MAX_CAL_POINTS
+     *        in total. With more than two points readPH() uses piecewise linear segments between
+     *        neighbouring buffers. The result is saved like any other calibration.
+     * 
+     * @param ph pH of the buffer solution
+     * @param voltage Voltage value of pH sensor when submerged in that buffer solution
+     * @return boolean false if all points are in use
      */
-    void manualCalibration(float voltage7, float voltage4); //manually input 2-point calibration values
+    boolean addCalibrationPoint(float ph, float voltage);
+    /**
+     * @brief Removes every buffer beyond pH 4.0 and 7.0, back to a two-point calibration
+     */
+    void clearCalibrationPoints();
     /**
      * @brief Converts voltage read by the pH sensor into pH value
-     *        Uses temperature measurement for a more accurate conversion
+     *        Uses temperature measurement for a more accurate conversion (Nernstian slope correction).
+     *        The correction is only recomputed when the temperature moves by more than PH_TEMPERATURE_THRESHOLD,
+     *        otherwise the conversion is a single multiply-add.
      * 
      * @param voltage Voltage value of pH sensor
      * @param temperature Temperature in degress celcius
      */
     float readPH(float voltage, float temperature); // voltage to pH value, with temperature compensation
-    void begin();            	//initialization
+    /**
+     * @brief Converts a series of voltages into pH values with the current calibration
+     *        Same result as calling readPH() for every sample, through the vectorizable kernels
+     *        in dfrobot-esp-ph-kernel.h which can also be built on a host.
+     *        Only converts: the live reading (latest(), alarms, history) is left to getPH().
+     * 
+     * @param voltage Voltage values of pH sensor
+     * @param temperature Temperatures in degress celcius, one per voltage, NULL to use the last temperature given to readPH()
+     * @param out Receives the pH values, must not overlap the inputs
+     * @param n Number of samples
+     */
+    void readPH(const float *voltage, const float *temperature, float *out, size_t n);
+    /**
+     * @brief Loads the calibration of this probe from NVS
+     *        The calibration is one CRC protected blob per probe. Values stored by older versions
+     *        under voltage7/voltage4 are picked up and migrated on the next write.
+     * 
+     * @param nvsKey Blob key, give each probe on a board its own key (at most 15 characters)
+     */
+    void begin(const char *nvsKey = PH_NVS_DEFAULT_KEY); //initialization
+    /**
+     * @brief Writes calibration values that are still waiting for the write throttle
+     *        Calibration changes are written at most once per PH_NVS_COMMIT_INTERVAL_MS; pending ones
+     *        are picked up by the next calibration() call or by this function.
+     *        EXITPH and manualCalibration() always write at once.
+     * 
+     * @param force true to write now even if the throttle interval has not passed
+     */
+    void flushCalibration(boolean force = true);
 	  float get_neutralVoltage();
+    /**
+     * @brief Gets the ADC count of the last getPH() call, after oversampling
+     * 
+     * @return float 
+     */
+    float getRaw();
+    /**
+     * @brief Gets the voltage of the last getPH() call, after smoothing
+     * 
+     * @return float mV
+     */
+    float getVoltage();
+    /**
+     * @brief Gets the temperature given to the last getPH() call
+     * 
+     * @return float C
+     */
+    float getTemperature();
+    /**
+     * @brief Hands every sample getPH() publishes to a logger, on the task that calls getPH()
+     * 
+     * @param logger Binary sample logger, NULL to stop logging
+     */
+    void setLogger(DFRobotESPpHLogger *logger);
 
     
     // added below
-    void init(int PH_PIN_in, float ESPADC_in, int ESPVOLTAGE_in);
+    /**
+     * @brief Assigns the pH pin and the ADC scaling
+     *        With useAdcCalibration the first call on ESP32 also builds the shared raw count to millivolt table
+     *        from the eFuse calibration, which then replaces the linear ESPADC/ESPVOLTAGE scaling. Stored
+     *        calibration voltages are taken under one scaling, switching it needs a new calibration.
+     * 
+     * @param PH_PIN_in Analog pin of the pH board
+     * @param ESPADC_in ADC full scale count, used for linear scaling
+     * @param ESPVOLTAGE_in ADC reference voltage in mV, used for linear scaling
+     * @param useAdcCalibration true to use the eFuse lookup table when the chip has one
+     */
+    void init(int PH_PIN_in, float ESPADC_in, float ESPVOLTAGE_in, boolean useAdcCalibration = false);
     float getPH(float temp_in);
+    /**
+     * @brief Enables or disables the serial trace of every voltage read by getPH()
+     *        Only has an effect when the library is built with DFROBOT_ESP_PH_DEBUG
+     * 
+     * @param enable true to print each voltage to Serial
+     */
+    void setDebug(boolean enable);
+    /**
+     * @brief Converts a raw analogRead() count to pH using only integer arithmetic
+     *        For ISRs and other contexts without floating point. The ADC lookup table is approximated
+     *        by a straight line, so results can differ from getPH() by a few hundredths of a pH.
+     *        Temperature compensation is the one of the last readPH()/getPH() call.
+     * 
+     * @param raw ADC count of PH_PIN
+     * @return int32_t pH value in Q16.16, see dfrobotPHFixedToFloat()
+     */
+    int32_t readPHFixed(uint16_t raw);
+    /**
+     * @brief Gets the integer conversion constants used by readPHFixed()
+     *        They can be copied to wherever the conversion runs, e.g. IRAM or RTC memory,
+     *        and applied with dfrobotPHFixedFromRaw()
+     * 
+     * @return const DFRobotESPpHFixed& 
+     */
+    const DFRobotESPpHFixed &getFixedCoefficients();
+    /**
+     * @brief Configures how many ADC samples getPH() takes and how they are reduced to one voltage
+     *        Sampling runs in a tight loop into a stack buffer, no heap is used
+     * 
+     * @param samples Number of samples per reading, 1 disables oversampling, clamped to PH_MAX_OVERSAMPLING
+     * @param mode PH_OVERSAMPLE_MEAN, PH_OVERSAMPLE_MEDIAN or PH_OVERSAMPLE_TRIMMED_MEAN
+     */
+    void setOversampling(byte samples, byte mode);
+    /**
+     * @brief Selects the recursive filter getPH() applies to each voltage before converting it
+     *        Both filters keep one or two floats of state and cost a few operations per sample, so a low
+     *        raw sample rate still gives smooth readings. The stability check and calibration capture see
+     *        the filtered voltage. Selecting a mode restarts the filter from the next sample.
+     * 
+     * @param mode PH_SMOOTH_NONE, PH_SMOOTH_EMA or PH_SMOOTH_KALMAN
+     */
+    void setSmoothing(byte mode);
+    /**
+     * @brief Selects the exponential moving average: v = v + alpha * (sample - v)
+     * 
+     * @param alpha Weight of the new sample, 0 < alpha <= 1, smaller is smoother
+     */
+    void setSmoothingEMA(float alpha);
+    /**
+     * @brief Selects the 1-D Kalman filter
+     *        The ratio of the two noises sets the smoothing: a small processNoise against measurementNoise
+     *        trusts the estimate more than each sample. The gain adapts after a restart, so the filter
+     *        settles faster than an EMA of the same steady-state smoothing.
+     * 
+     * @param processNoise Variance of the real voltage change between two samples, mV^2
+     * @param measurementNoise Variance of the ADC noise, mV^2
+     */
+    void setSmoothingKalman(float processNoise, float measurementNoise);
+    /**
+     * @brief Hands PH_PIN over to the continuous (DMA) ADC driver, call after init()
+     *        The driver fills its buffers in the background and getPH() only reduces the latest block,
+     *        so a reading never waits on a conversion. Oversampling settings are ignored while streaming.
+     *        The driver is global to the chip, so only one instance can stream at a time.
+     *        Requires arduino-esp32 3.x, returns false otherwise.
+     * 
+     * @param sampleRateHz ADC conversion rate
+     * @param conversionsPerBlock Conversions averaged into each block
+     * @return boolean true if streaming started
+     */
+    boolean startStreaming(uint32_t sampleRateHz, uint32_t conversionsPerBlock);
+    /**
+     * @brief Stops the continuous ADC driver and returns to synchronous analogRead() sampling
+     */
+    void stopStreaming();
+    /**
+     * @brief Arms the ULP coprocessor to watch the pH while the main cores are in deep sleep
+     *        The ULP reads PH_PIN every periodMs and wakes the chip only once the pH has moved by more than
+     *        phBand from the current reading. Thresholds are raw ADC counts derived from the fixed-point
+     *        coefficients, so the ULP never converts anything. Temperature compensation is the one of the
+     *        last getPH() call. The coefficients are kept in RTC memory, so after the wake-up
+     *        lowPowerPH() and resumeLowPower() work without init() or begin().
+     *        Call esp_deep_sleep_start() afterwards. PH_PIN must be an ADC1 pin; original ESP32 only.
+     * 
+     * @param phBand pH change that wakes the chip
+     * @param periodMs Time between two ULP readings
+     * @return boolean false if the chip, pin or build has no ULP support
+     */
+    boolean startLowPower(float phBand, uint32_t periodMs);
+    /**
+     * @brief Re-arms the ULP after a wake-up, centred on the reading that caused it
+     *        Uses the band, period and coefficients stored by startLowPower()
+     * 
+     * @return boolean false if startLowPower() was never called since power-on
+     */
+    static boolean resumeLowPower();
+    /**
+     * @brief Tells whether the chip was woken from deep sleep by the pH watch
+     * 
+     * @return boolean 
+     */
+    static boolean lowPowerWakeup();
+    /**
+     * @brief Gets the pH of the last ULP reading, with the coefficients stored by startLowPower()
+     * 
+     * @return float 
+     */
+    static float lowPowerPH();
+    /**
+     * @brief Starts a FreeRTOS task that calls getPH() every periodMs, ESP32 only
+     *        Consumers on other tasks or cores read the result with latest() and never wait on the ADC.
+     *        While the task runs, do not call getPH() from elsewhere.
+     * 
+     * @param periodMs Sampling period
+     * @param core Core to pin the task to, -1 for no affinity
+     * @param priority FreeRTOS priority of the task
+     * @return boolean true if the task was created
+     */
+    boolean startTask(uint32_t periodMs, int core, byte priority = 1);
+    /**
+     * @brief Stops the background sampling task and waits until it has exited
+     */
+    void stopTask();
+    /**
+     * @brief Lets the background task adapt its period to the signal
+     *        After every sample the period is halved (PH_ADAPT_FASTER) while the pH changes faster than
+     *        phPerMinute or the history spread exceeds stddev, and grown by PH_ADAPT_SLOWER while both stay
+     *        under half of that, always within [minMs, maxMs]. A flat signal is then sampled at maxMs and
+     *        a moving one quickly drops to minMs. A step of more than twice stddev between two samples also
+     *        counts as moving. The period given to startTask() is the starting point.
+     * 
+     * @param minMs Shortest period, 0 to go back to the fixed period
+     * @param maxMs Longest period
+     * @param phPerMinute Rate of change that counts as moving
+     * @param stddev Standard deviation of the pH history that counts as moving
+     */
+    void setAdaptivePeriod(uint32_t minMs, uint32_t maxMs, float phPerMinute = 0.1, float stddev = 0.02);
+    /**
+     * @brief Gets the period the background task currently samples at
+     * 
+     * @return uint32_t ms
+     */
+    uint32_t getTaskPeriod();
+    /**
+     * @brief Sets the temperature the background task compensates with
+     *        Safe to call from any task
+     * 
+     * @param temperature Temperature in degress celcius
+     */
+    void setTemperature(float temperature);
+    /**
+     * @brief Gets the most recent sample taken by getPH(), from any task or core
+     *        Retries the copy if a sample is published meanwhile, PH_LATEST_SPIN_RETRIES times at once,
+     *        then one tick apart so a preempted publisher on the same core can finish.
+     *        Call it from a task, not from an ISR.
+     * 
+     * @return DFRobotESPpHReading 
+     */
+    DFRobotESPpHReading latest();
+    /**
+     * @brief Gets the pH values of the last PH_HISTORY_LENGTH getPH() calls with their rolling statistics
+     *        mean(), min(), max() and stddev() are O(1). Read it from the task that calls getPH();
+     *        other tasks get the same statistics through latest().
+     * 
+     * @return const DFRobotESPpHHistory<PH_HISTORY_LENGTH>& 
+     */
+    const DFRobotESPpHHistory<PH_HISTORY_LENGTH> &getHistory();
+    /**
+     * @brief Drops the pH history, e.g. after moving the probe to another solution
+     */
+    void clearHistory();
+    /**
+     * @brief Tells whether the voltage has settled
+     *        True once the least-squares slope over the last PH_STABILITY_WINDOW trend points stays within
+     *        the stability threshold. A point is the mean voltage of the getPH() calls in PH_STABILITY_INTERVAL_MS
+     *        (or a single call when they are further apart), so the window spans at least 4 s at any call rate
+     * 
+     * @return boolean 
+     */
+    boolean isStable();
+    /**
+     * @brief Gets the drift of the voltage over the last PH_STABILITY_WINDOW trend points
+     * 
+     * @return float mV per second, 0 until the window is full
+     */
+    float getVoltageSlope();
+    /**
+     * @brief Sets the drift below which the reading counts as stable
+     * 
+     * @param mvPerSecond Maximum absolute slope in mV/s, PH_STABLE_SLOPE_MV_PER_S by default
+     */
+    void setStabilityThreshold(float mvPerSecond);
+    /**
+     * @brief Makes calibration capture the buffer voltage by itself once the reading is stable
+     *        With it enabled, every buffer the probe is moved into during ENTERPH is captured once the reading
+     *        has moved and then settled again, so the rinse water or the buffer just captured is not taken twice.
+     *        Without it, CALPH arms a capture that getPH() takes once the reading is stable, or after
+     *        PH_CAPTURE_TIMEOUT_MS; a second CALPH while waiting captures at the next getPH().
+     * 
+     * @param enable true to capture without CALPH
+     */
+    void setAutoCapture(boolean enable);
+    /**
+     * @brief Replaces the voltage windows in which CALPH recognizes the 4.0, 7.0 and 10.0 buffers
+     *        The table is not copied and must outlive the instance; probe profiles pass a static one
+     * 
+     * @param windows Table of buffers, NULL for the PH_*_VOLTAGE defaults
+     * @param count Number of entries
+     */
+    void setBufferWindows(const DFRobotESPpHBufferWindow *windows, byte count);
+    /**
+     * @brief Registers the function getPH() calls when an alarm is raised or cleared
+     *        The alarm setters also call it, from the caller's task, when the last sample raises or clears
+     *        an alarm against the new limit and hysteresis.
+     *        With the background task the callback runs on that task, keep it short and do not call getPH() from it
+     * 
+     * @param callback Function to call, NULL to stop notifications (the alarm state is still tracked)
+     * @param context Passed back to the callback unchanged
+     */
+    void setAlarmCallback(DFRobotESPpHAlarmCallback callback, void *context = NULL);
+    /**
+     * @brief Raises PH_EVENT_HIGH when the pH goes above limit, PH_EVENT_HIGH_CLEARED once it is back below limit - hysteresis
+     * 
+     * @param limit pH, NAN to disable the alarm
+     * @param hysteresis pH the reading must drop below the limit before the alarm clears
+     */
+    void setHighAlarm(float limit, float hysteresis = 0.1);
+    /**
+     * @brief Raises PH_EVENT_LOW when the pH goes below limit, PH_EVENT_LOW_CLEARED once it is back above limit + hysteresis
+     * 
+     * @param limit pH, NAN to disable the alarm
+     * @param hysteresis pH the reading must rise above the limit before the alarm clears
+     */
+    void setLowAlarm(float limit, float hysteresis = 0.1);
+    /**
+     * @brief Raises PH_EVENT_RATE when the pH changes faster than limit in either direction
+     *        The rate is the stability slope (PH_STABILITY_WINDOW trend points) converted with the pH 4/7 fit,
+     *        so it is only evaluated once the window is full
+     * 
+     * @param limit pH per minute, NAN to disable the alarm
+     * @param hysteresis pH per minute the rate must drop below the limit before the alarm clears
+     */
+    void setRateAlarm(float limit, float hysteresis = 0.05);
+    /**
+     * @brief Gets the alarms that are currently raised
+     * 
+     * @return byte PH_ALARM_* bits
+     */
+    byte getAlarmState();
+    /**
+     * @brief Gets the probe slope, offset and response time of the current calibration
+     *        The slope and offset are in probe mV (board voltage around PH_BOARD_MIDPOINT_VOLTAGE divided by
+     *        PH_BOARD_GAIN), the slope compared to the Nernstian slope at the calibration temperature.
+     *        The response time runs from the first unstable reading after the probe is moved to the next
+     *        stable one (see isStable()), so getPH() must be called while the probe settles in each buffer.
+     *        health grades the slope and offset against the PH_HEALTH_* limits.
+     * 
+     * @return DFRobotESPpHDiagnostics 
+     */
+    DFRobotESPpHDiagnostics getDiagnostics();
 };
 
 #endif
@@ -0,0 +1,93 @@
+/*
+ * file extras/host/Arduino.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Minimal Arduino core for building the library on a desktop, see README.md in this folder
+ * Only what the library uses is provided; analogRead() and millis() are driven by the harness.
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+#ifndef _DFROBOT_ESP_PH_HOST_ARDUINO_H_
+#define _DFROBOT_ESP_PH_HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define F(string_literal) (string_literal)
+
+unsigned long millis();
+unsigned long micros();
+int analogRead(uint8_t pin);
+
+/**
+ * @brief Sets what analogRead() returns, a simulated probe
+ * 
+ * @param source called with the pin for every analogRead(), NULL for a constant 2048
+ */
+void hostSetAnalogSource(int (*source)(uint8_t pin));
+/**
+ * @brief Moves the simulated clock behind millis()/micros()
+ * 
+ * @param ms milliseconds to add
+ */
+void hostAdvanceMillis(unsigned long ms);
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--)
+        {
+            n += write(*buffer++);
+        }
+        return n;
+    }
+    size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return printf("%d", value); }
+    size_t print(unsigned int value) { return printf("%u", value); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+    size_t println() { return print("\r\n"); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+    size_t println(double value, int digits) { return print(value, digits) + println(); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+/**
+ * @brief Serial replacement: output goes to stdout when echo is on, input comes from inject()
+ */
+class HardwareSerial : public Stream {
+public:
+    HardwareSerial();
+    size_t write(uint8_t c);
+    int available();
+    int read();
+    void inject(const char *text); // queue text as if it had been received
+    boolean echo;                  // copy output to stdout, off by default so benchmarks stay quiet
+private:
+    char _input[256];
+    size_t _head;
+    size_t _tail;
+};
+
+extern HardwareSerial Serial;
+
+#endif
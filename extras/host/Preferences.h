@@ -0,0 +1,34 @@
+/*
+ * file extras/host/Preferences.h * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * In-memory replacement of the ESP32 Preferences (NVS) library for host builds
+ * Values survive for the life of the process, which is enough to exercise save and load paths.
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+#ifndef _DFROBOT_ESP_PH_HOST_PREFERENCES_H_
+#define _DFROBOT_ESP_PH_HOST_PREFERENCES_H_
+
+#include "Arduino.h"
+
+#define HOST_PREFERENCES_MAX_KEYS 32
+#define HOST_PREFERENCES_MAX_VALUE 128
+
+class Preferences {
+public:
+    Preferences();
+    bool begin(const char *name, bool readOnly = false, const char *partition = NULL);
+    void end();
+    bool isKey(const char *key);
+    bool remove(const char *key);
+    size_t putFloat(const char *key, float value);
+    float getFloat(const char *key, float defaultValue = NAN);
+    size_t putBytes(const char *key, const void *value, size_t length);
+    size_t getBytes(const char *key, void *buffer, size_t length);
+    size_t getBytesLength(const char *key);
+    static unsigned long writes; // putFloat()/putBytes() calls, lets a benchmark count NVS traffic
+private:
+    int find(const char *key);
+};
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * file extras/host/bench.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Host benchmark of the library hot paths: conversion, command parsing and calibration
+ * Build and run from the repository root, see README.md in this folder:
+ *   g++ -std=gnu++17 -O2 -I extras/host -I . extras/host/bench.cpp extras/host/host.cpp dfrobot-esp-ph*.cpp -o ph-bench
+ *   ./ph-bench [iterations]
+ *
+ * Copyright   GNU Lesser General Public License
+ */
+#include "dfrobot-esp-ph.h"
+#include <chrono>
+
+#define BENCH_DEFAULT_ITERATIONS 1000000UL
+#define BENCH_BATCH 256
+
+static volatile float sink; // keeps results alive so the compiler cannot drop the measured work
+
+/**
+ * @brief Print that discards everything, calibration messages are not part of the measurement
+ */
+class NullPrint : public Print {
+public:
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+};
+
+/**
+ * @brief Stream replaying the same text forever, feeds cmdSerialDataAvailable() without running dry
+ */
+class ReplayStream : public Stream {
+public:
+    ReplayStream(const char *text) : _text(text), _position(0) {}
+    size_t write(uint8_t) { return 1; }
+    int available() { return 1; }
+    int read() {
+        char c = this->_text[this->_position++];
+        if (this->_text[this->_position] == '\0')
+        {
+            this->_position = 0;
+        }
+        return (uint8_t)c;
+    }
+private:
+    const char *_text;
+    size_t _position;
+};
+
+/**
+ * @brief Simulated probe: a slow triangle around the pH 7 voltage with a little ripple
+ */
+static int probe(uint8_t pin) {
+    static uint32_t step = 0;
+    (void)pin;
+    step++;
+    int ramp = (int)(step % 400);
+    ramp = ramp < 200 ? ramp : 400 - ramp;
+    return 1760 + ramp + (int)(step & 3);
+}
+
+/**
+ * @brief Prints one result line
+ *
+ * @param name what was measured
+ * @param start time before the loop
+ * @param operations number of calls in the loop
+ */
+static void report(const char *name, std::chrono::steady_clock::time_point start, unsigned long operations) {
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-28s %12lu ops %10.2f ns/op\n", name, operations, ns / operations);
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+    NullPrint quiet;
+    DFRobotESPpH ph;
+    hostSetAnalogSource(probe);
+    ph.init(36, 4096, 3300, false);
+    ph.begin();
+    ph.setOutput(quiet);
+    ph.manualCalibration(1500, 2032);
+
+    std::chrono::steady_clock::time_point start;
+    float acc = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        acc += ph.readPH(1200.0f + (i & 1023), 25.0f);
+    }
+    report("readPH", start, iterations);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        acc += ph.readPH(1200.0f + (i & 1023), 20.0f + (i & 15)); // crosses the recompute threshold every call
+    }
+    report("readPH, changing temperature", start, iterations);
+
+    float voltage[BENCH_BATCH], temperature[BENCH_BATCH], out[BENCH_BATCH];
+    for (int i = 0; i < BENCH_BATCH; i++)
+    {
+        voltage[i] = 1200.0f + i * 3;
+        temperature[i] = 15.0f + (i % 20);
+    }
+    unsigned long batches = iterations / BENCH_BATCH + 1;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < batches; i++)
+    {
+        ph.readPH(voltage, NULL, out, BENCH_BATCH);
+        acc += out[i % BENCH_BATCH];
+    }
+    report("readPH batch", start, batches * BENCH_BATCH);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < batches; i++)
+    {
+        ph.readPH(voltage, temperature, out, BENCH_BATCH);
+        acc += out[i % BENCH_BATCH];
+    }
+    report("readPH batch, temperatures", start, batches * BENCH_BATCH);
+
+    int32_t fixedAcc = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        fixedAcc += ph.readPHFixed(1500 + (i & 1023));
+    }
+    report("readPHFixed", start, iterations);
+    acc += fixedAcc;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        acc += ph.getPH(25.0f);
+    }
+    report("getPH", start, iterations);
+
+    // command parsing: a line that is not a command, and one that is but changes nothing outside calibration mode
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        ph.calibration("hello world");
+    }
+    report("cmdParse, no command", start, iterations);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        ph.calibration("exitph");
+    }
+    report("cmdParse, EXITPH", start, iterations);
+
+    static const char frame[] = "CALPH\nEXITPH\n";
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        ph.feedCommand(frame, sizeof(frame) - 1);
+    }
+    report("feedCommand, two lines", start, iterations * 2);
+
+    ReplayStream stream("CALPH 6.86\nexitph\n");
+    ph.setCommandStream(&stream);
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        ph.calibration(); // cmdSerialDataAvailable() reads one whole line per call
+    }
+    report("cmdSerialDataAvailable line", start, iterations);
+    ph.setCommandStream(NULL);
+
+    // full calibration: capture a buffer and store it, the NVS throttle is kept out of the way
+    unsigned long cycles = iterations / 100 + 1;
+    hostSetAnalogSource(NULL); // steady probe, so CALPH captures at once
+    for (int i = 0; i <= PH_STABILITY_WINDOW; i++) // one more, the first point still averages the triangle
+    {
+        hostAdvanceMillis(PH_STABILITY_INTERVAL_MS);
+        ph.getPH(25.0f);
+    }
+    unsigned long writesBefore = Preferences::writes;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < cycles; i++)
+    {
+        ph.calibration("ENTERPH");
+        ph.calibration("CALPH 7");
+        ph.calibration("CALPH 7"); // ENTERPH restarted the window, the second CALPH captures without waiting
+        ph.getPH(25.0f); // takes the capture CALPH armed
+        ph.calibration("EXITPH");
+        ph.flushCalibration();
+        hostAdvanceMillis(PH_NVS_COMMIT_INTERVAL_MS);
+    }
+    report("calibration cycle", start, cycles);
+    printf("%-28s %12lu writes\n", "  NVS", Preferences::writes - writesBefore);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < cycles; i++)
+    {
+        ph.begin();
+    }
+    report("begin (blob load)", start, cycles);
+
+    sink = acc;
+    return 0;
+}
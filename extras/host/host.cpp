@@ -0,0 +1,183 @@
+/*
+ * file extras/host/host.cpp * @ https://github.com/GreenPonik/DFRobotESPpH_BY_GREENPONIK
+ *
+ * Definitions behind the host Arduino.h and Preferences.h
+ * 
+ * Copyright   GNU Lesser General Public License
+ */
+#include "Arduino.h"
+#include "Preferences.h"
+#include <stdarg.h>
+
+HardwareSerial Serial;
+
+static unsigned long hostMillis = 1;
+static int (*hostAnalogSource)(uint8_t pin) = NULL;
+
+unsigned long millis() {
+    return hostMillis;
+}
+
+unsigned long micros() {
+    return hostMillis * 1000;
+}
+
+void hostAdvanceMillis(unsigned long ms) {
+    hostMillis += ms;
+}
+
+int analogRead(uint8_t pin) {
+    return hostAnalogSource != NULL ? hostAnalogSource(pin) : 2048;
+}
+
+void hostSetAnalogSource(int (*source)(uint8_t pin)) {
+    hostAnalogSource = source;
+}
+
+size_t Print::printf(const char *format, ...) {
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return 0;
+    }
+    return write((const uint8_t *)buffer, (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+HardwareSerial::HardwareSerial() {
+    this->echo = false;
+    this->_head = 0;
+    this->_tail = 0;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (this->echo)
+    {
+        putchar(c);
+    }
+    return 1;
+}
+
+int HardwareSerial::available() {
+    return (int)((this->_head - this->_tail) % sizeof(this->_input));
+}
+
+int HardwareSerial::read() {
+    if (this->_head == this->_tail)
+    {
+        return -1;
+    }
+    char c = this->_input[this->_tail];
+    this->_tail = (this->_tail + 1) % sizeof(this->_input);
+    return (uint8_t)c;
+}
+
+void HardwareSerial::inject(const char *text) {
+    while (*text)
+    {
+        size_t next = (this->_head + 1) % sizeof(this->_input);
+        if (next == this->_tail)
+        {
+            return; // full, drop the rest like a UART would
+        }
+        this->_input[this->_head] = *text++;
+        this->_head = next;
+    }
+}
+
+// one flat store shared by all namespaces, like a single NVS partition
+static struct {
+    char key[16];
+    size_t length;
+    uint8_t value[HOST_PREFERENCES_MAX_VALUE];
+} hostStore[HOST_PREFERENCES_MAX_KEYS];
+static size_t hostStoreCount = 0;
+
+unsigned long Preferences::writes = 0;
+
+Preferences::Preferences() {
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition) {
+    (void)name;
+    (void)readOnly;
+    (void)partition;
+    return true;
+}
+
+void Preferences::end() {
+}
+
+int Preferences::find(const char *key) {
+    for (size_t i = 0; i < hostStoreCount; i++)
+    {
+        if (strncmp(hostStore[i].key, key, sizeof(hostStore[i].key)) == 0)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool Preferences::isKey(const char *key) {
+    return find(key) >= 0;
+}
+
+bool Preferences::remove(const char *key) {
+    int i = find(key);
+    if (i < 0)
+    {
+        return false;
+    }
+    hostStore[i] = hostStore[--hostStoreCount];
+    return true;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+    if (length > HOST_PREFERENCES_MAX_VALUE)
+    {
+        return 0;
+    }
+    int i = find(key);
+    if (i < 0)
+    {
+        if (hostStoreCount == HOST_PREFERENCES_MAX_KEYS)
+        {
+            return 0;
+        }
+        i = (int)hostStoreCount++;
+        strncpy(hostStore[i].key, key, sizeof(hostStore[i].key) - 1);
+        hostStore[i].key[sizeof(hostStore[i].key) - 1] = '\0';
+    }
+    memcpy(hostStore[i].value, value, length);
+    hostStore[i].length = length;
+    writes++;
+    return length;
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t length) {
+    int i = find(key);
+    if (i < 0 || hostStore[i].length > length)
+    {
+        return 0;
+    }
+    memcpy(buffer, hostStore[i].value, hostStore[i].length);
+    return hostStore[i].length;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    int i = find(key);
+    return i < 0 ? 0 : hostStore[i].length;
+}
+
+size_t Preferences::putFloat(const char *key, float value) {
+    return putBytes(key, &value, sizeof(value));
+}
+
+float Preferences::getFloat(const char *key, float defaultValue) {
+    float value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}